@@ -225,6 +225,11 @@ int main() {
         } else if (nfds == 2 || (nfds == 1 && events[0].data.fd == sfd)) {
           //if nfds is 2 then both stdin and the server have returned an answer at the same time, a very unfortunate happenstance, server gets the priority
           if (recv(sfd, &recv_msg, sizeof(message), 0) == -1) { error_print("search thread recv"); continue; }
+          if (recv_msg == message::rejection) {
+            fprintf(stdout, "the server is shutting down, no match can start\n");
+            client_state = state::logged_in;
+            continue;
+          }
           //recv_msg will just be white or black, doubles as a confirmation that an opponent was found and the match can start
           client_state = state::in_game;
           fprintf(stdout, "found opponent, starting as ");
@@ -286,6 +291,9 @@ int main() {
                 fprintf(stdout, ", but ");
               }
               fprintf(stdout, "the opponent forfeited the match\n");
+            } else if (recv_msg == message::won) {
+              //no move comes with it
+              fprintf(stdout, "the opponent ran out of time, you won\n");
             } else {
               auto &&move = get_move(sfd);
               if (!move) {
@@ -351,6 +359,8 @@ int main() {
                 print_move(move_opt.value().value());
                 std::cout << std::endl;
               }
+            } else if (recv_msg == message::won) {
+              fprintf(stdout, "the opponent ran out of time before you could, you won\n");
             } else {
               auto &&move = get_move(sfd);
               if (!move) {
@@ -398,8 +408,9 @@ int main() {
         } else if (nfds == 2 || (nfds == 1 && events[0].data.fd == sfd)) {
           if (nfds == 2) { fprintf(stdout, "your command was ignored due to recieving data from the server at the same time\n"); }
           if (recv(sfd, &recv_msg, sizeof(message), 0) == -1) { error_print("oppoennt forfeit recv"); continue; }
-          //always message::forfeit
-          fprintf(stdout, "opponent forfeited match\n");
+          //message::forfeit, or message::lost if your clock ran out
+          if (recv_msg == message::lost) { fprintf(stdout, "you ran out of time\n"); }
+          else { fprintf(stdout, "opponent forfeited match\n"); }
           fprintf(stdout, "going back to the main menu...\n");
           client_state = state::logged_in;
           continue;
@@ -434,6 +445,8 @@ int main() {
               } else if (recv_msg == message::forfeit) {
                 //could send move as opposing player forfeit is being processed, counts as you not even getting ur move checked, sorry
                 fprintf(stdout, "opponent forfeited the match\n");
+              } else if (recv_msg == message::lost) {
+                fprintf(stdout, "you ran out of time\n");
               }
               fprintf(stdout, "going back to the main menu...\n");
               client_state = state::logged_in;
@@ -22,8 +22,10 @@ enum class color : bool {
 //        lost + moveset | draw + moveset | forfeit + moveset | forfeit
 //    - else:
 //        lost + moveset | draw + moveset | move + moveset
-// overall, check for: lost + moveset | draw + moveset | move + moveset | forfeit + moveset | forfeit
-// when in a game and it's its turn, a player should expect a forfeit.
+//    - if the opponent's clock ran out:
+//        won
+// overall, check for: lost + moveset | draw + moveset | move + moveset | forfeit + moveset | forfeit | won
+// when in a game and it's its turn, a player should expect a forfeit, or lost if its own clock runs out.
 //
 // when waiting for a message and a moveset, use recv with MSG_DONTWAIT for the moveset
 // if the moveset is optional, EAGAIN or EWOULDBLOCK means no moveset was sent
@@ -45,10 +47,12 @@ enum class message : uint8_t {
   //        forfeit
   //    - if sending the move to the opponent fails:
   //        forfeit
+  //    - if the player's clock ran out before the move came in:
+  //        lost
   //    - else:
   //        won | draw | confirmation | rejection
   // overall, check for:
-  //    won | draw | confirmation | rejection | forfeit
+  //    won | draw | confirmation | rejection | forfeit | lost
   move,
   // message: 1 byte
   //
@@ -108,12 +112,15 @@ enum class message : uint8_t {
   rejection,
   // message: 1 byte
   //
-  // sent to the client that won
+  // sent to the client that won, never along with a move:
+  //    as the answer to its mating move
+  //    on its own when the opponent's clock ran out
   won,
   // message: 1 byte
   //
-  // sent to the client that lost
-  // will always be sent along with a move
+  // sent to the client that lost:
+  //    along with the opponent's mating move
+  //    on its own when the client's clock ran out
   lost,
   // message: 1 byte
   //
@@ -139,6 +146,7 @@ enum class message : uint8_t {
   //
   // starts looking for a match
   // does not expect anything immediately, but it can recieve white or black from the server
+  // gets a rejection instead if the server is shutting down, the player stays in the lobby then
   play,
   // structure:
   // message: 1 byte
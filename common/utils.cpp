@@ -98,6 +98,18 @@ std::string_view get_message_as_text(message m) {
   }
   return NULL;
 }
+size_t get_frame_length(const uint8_t *data, size_t available) {
+  if (available < sizeof(message)) { return 0; }
+  switch (static_cast<message>(data[0])) {
+    case message::move: return sizeof(message) + 3 * sizeof(uint8_t);
+    case message::signup_data:
+    case message::login_data:
+      if (available < sizeof(message) + 2 * sizeof(uint8_t)) { return 0; }
+      return sizeof(message) + 2 * sizeof(uint8_t) + data[1] + data[2];
+    //everything else clients send, valid or not, is just the message
+    default: return sizeof(message);
+  }
+}
 std::string_view get_promotion_as_text(promotion p) {
   switch (p) {
     case promotion::none: return "";
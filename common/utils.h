@@ -30,4 +30,7 @@ void error_print(std::string_view, int = errno);
 sigset_t get_all_but_SIGINT_blocking_mask();
 bool FlipSocketBlocking(int, bool);
 std::string_view get_message_as_text(message);
+// length of the frame a client sent, laid out as in enums.h, starting with the passed bytes
+// 0 if there aren't enough bytes yet to tell
+size_t get_frame_length(const uint8_t *, size_t);
 std::string_view get_promotion_as_text(promotion);
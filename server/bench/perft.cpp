@@ -0,0 +1,113 @@
+#include "../src/board.h"
+#include "../src/bitboard.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// counts the leaves of the legal move tree, checks them against known values and reports how fast it went
+// usage: perft [max depth] [threads]
+
+struct perft_position {
+  std::string_view name;
+  std::string_view fen;
+  // known leaf counts, the first one is for depth 1
+  std::vector<uint64_t> nodes;
+};
+
+// the usual set of positions that shake out castling, en passant, promotion and pin bugs
+static const std::array<perft_position, 5> positions = {
+  perft_position { "start position", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", { 20, 400, 8902, 197281, 4865609, 119060324 } },
+  perft_position { "kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", { 48, 2039, 97862, 4085603, 193690690 } },
+  perft_position { "position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", { 14, 191, 2812, 43238, 674624, 11030083 } },
+  perft_position { "position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1", { 6, 264, 9467, 422333, 15833292 } },
+  perft_position { "position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8", { 44, 1486, 62379, 2103487, 89941194 } },
+};
+
+uint64_t perft(board &b, unsigned depth) {
+  move_list moves;
+  b.generate_legal_moves(moves);
+  //bulk counting, the last ply doesn't have to be played
+  if (depth == 1) {
+    return moves.size();
+  }
+  uint64_t retval = 0;
+  for (packed_move m : moves) {
+    board::undo_record undo;
+    b.make_move(m, undo);
+    retval += perft(b, depth - 1);
+    b.unmake_move(m, undo);
+  }
+  return retval;
+}
+// the root moves are dealt out to the threads, each thread works on its own copy of the board
+uint64_t perft_split(const board &b, unsigned depth, unsigned thread_count) {
+  move_list moves;
+  b.generate_legal_moves(moves);
+  if (depth == 1 || thread_count <= 1) {
+    board copy = b;
+    return perft(copy, depth);
+  }
+  std::atomic<size_t> next_move = 0;
+  std::atomic<uint64_t> retval = 0;
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < thread_count; i += 1) {
+    threads.emplace_back([&]() {
+      board copy = b;
+      uint64_t nodes = 0;
+      for (size_t idx = next_move++; idx < moves.size(); idx = next_move++) {
+        const packed_move m = *(moves.begin() + idx);
+        board::undo_record undo;
+        copy.make_move(m, undo);
+        nodes += perft(copy, depth - 1);
+        copy.unmake_move(m, undo);
+      }
+      retval += nodes;
+    });
+  }
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  return retval;
+}
+
+int main(int argc, char **argv) {
+  const unsigned max_depth = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : 5;
+  const unsigned thread_count = argc > 2 ? static_cast<unsigned>(atoi(argv[2])) : 1;
+  attacks::init();
+
+  bool all_correct = true;
+  uint64_t total_nodes = 0;
+  double total_seconds = 0;
+  for (const perft_position &position : positions) {
+    board b;
+    if (!b.load_fen(position.fen)) {
+      fprintf(stdout, "%-16s could not load %s\n", position.name.data(), position.fen.data());
+      all_correct = false;
+      continue;
+    }
+    for (unsigned depth = 1; depth <= max_depth && depth <= position.nodes.size(); depth += 1) {
+      auto start = std::chrono::steady_clock::now();
+      uint64_t nodes = perft_split(b, depth, thread_count);
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      bool correct = nodes == position.nodes[depth - 1];
+      all_correct = all_correct && correct;
+      total_nodes += nodes;
+      total_seconds += seconds;
+      fprintf(stdout, "%-16s depth %u: %12lu nodes %-7s %9.3f s %9.2f Mnps\n", position.name.data(), depth, nodes,
+              correct ? "(ok)" : "(WRONG)", seconds, seconds > 0 ? nodes / seconds / 1e6 : 0.0);
+      if (!correct) {
+        fprintf(stdout, "%-16s expected %lu\n", "", position.nodes[depth - 1]);
+      }
+    }
+  }
+  fprintf(stdout, "total: %lu nodes in %.3f s, %.2f Mnps with %u thread(s)\n", total_nodes, total_seconds,
+          total_seconds > 0 ? total_nodes / total_seconds / 1e6 : 0.0, thread_count);
+  return all_correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -4,187 +4,572 @@
 #include "../../common/enums.h"
 #include "user.h"
 #include "player_queue.h"
+#include "connection.h"
 
 #include <unistd.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
 #include <thread>
 #include <optional>
 #include <iostream>
+#include <algorithm>
 
-int big_poll::listening_socket;
-int big_poll::epoll_fd;
-std::vector<epoll_event> big_poll::events;
-size_t big_poll::events_capacity = 100;
-size_t big_poll::events_size = 1;
-std::mutex big_poll::mutex;
-
-void big_poll::remove_disconnected_socket(size_t idx_to_remove) {
-  const std::lock_guard lock(mutex);
-
-  user::disconnectUser(events[idx_to_remove].data.fd);
-
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, events[idx_to_remove].data.fd, NULL) == -1) { error_print("big_poll epoll_ctl remove disconnected client"); }
-
-  events_size -= 1;
-
-  if (close(events[idx_to_remove].data.fd) == -1) { error_print("big_poll close disconnected client"); }
-
-  fprintf(stderr, "disconnected socket %lu %d\n", idx_to_remove, events[idx_to_remove].data.fd);
+namespace {
+  thread_local big_poll *current_reactor = nullptr;
 }
-void big_poll::remove_socket(size_t idx_to_remove) {
-  const std::lock_guard lock(mutex);
-
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, events[idx_to_remove].data.fd, NULL) == -1) { error_print("epoll_ctl big_poll remove disconnected client"); }
-
-  events_size -= 1;
 
-  fprintf(stderr, "removed socket %lu %d\n", idx_to_remove, events[idx_to_remove].data.fd);
+std::vector<big_poll *> big_poll::reactors;
+std::vector<std::thread> big_poll::threads;
+std::atomic<size_t> big_poll::running_reactors = 0;
+int big_poll::stopped_eventfd = -1;
+unsigned big_poll::drain_seconds = 0;
+std::chrono::seconds big_poll::idle_timeout = std::chrono::seconds(0);
+
+big_poll::big_poll(int listening_socket, io_backend::kind backend_kind) : m_listening_socket(listening_socket), m_backend_kind(backend_kind), m_events(100), m_events_size(2) {}
+void big_poll::start(const std::vector<int> &listening_sockets, io_backend::kind backend_kind, std::chrono::seconds idle) {
+  idle_timeout = idle;
+  connection::init_table();
+  stopped_eventfd = eventfd(0, EFD_CLOEXEC);
+  if (stopped_eventfd == -1) { error_print("big_poll stopped eventfd"); }
+  for (int listening_socket : listening_sockets) {
+    reactors.push_back(new big_poll(listening_socket, backend_kind));
+  }
+  running_reactors.store(reactors.size());
+  for (big_poll *reactor : reactors) {
+    threads.emplace_back(&big_poll::poll_users, reactor);
+  }
 }
-void big_poll::recv_send_fail_handler(size_t idx_to_remove, std::string_view message) {
-  const std::lock_guard lock(mutex);
-
-  int err = errno;
-  error_print(message);
-
-  user::disconnectUser(events[idx_to_remove].data.fd);
+void big_poll::drain(unsigned seconds) {
+  drain_seconds = seconds;
+  for (big_poll *reactor : reactors) {
+    reactor->m_tasks.push({ task::type::drain, -1, 0, {}, nullptr });
+  }
+}
+void big_poll::shut_down() {
+  for (big_poll *reactor : reactors) {
+    reactor->m_tasks.push({ task::type::shut_down, -1, 0, {}, nullptr });
+  }
+}
+int big_poll::stopped_fd() {
+  return stopped_eventfd;
+}
+void big_poll::join() {
+  for (std::thread &reactor_thread : threads) {
+    reactor_thread.join();
+  }
+  threads.clear();
+}
+big_poll *big_poll::owner_of(int fd, uint32_t generation) {
+  connection *c = connection::find(fd);
+  if (c == nullptr || c->generation.load() != generation) { return nullptr; }
+  return c->owner.load();
+}
+bool big_poll::is_own(int fd, uint32_t generation) const {
+  connection *c = connection::find(fd);
+  return c != nullptr && c->owner.load() == this && c->generation.load() == generation;
+}
+ssize_t big_poll::send_socket(int fd, uint32_t generation, const void *buf, size_t len) {
+  big_poll *owner = owner_of(fd, generation);
+  if (owner == nullptr) {
+    errno = EBADF;
+    return -1;
+  }
+  if (owner == current_reactor) { return io_backend::send_socket(fd, buf, len, 0); }
+  const uint8_t *bytes = static_cast<const uint8_t *>(buf);
+  owner->m_tasks.push({ task::type::send, fd, generation, std::vector<uint8_t>(bytes, bytes + len), nullptr });
+  return static_cast<ssize_t>(len);
+}
+void big_poll::close_socket(int fd, uint32_t generation) {
+  route({ task::type::close, fd, generation, {}, nullptr });
+}
+void big_poll::join_game(int fd, uint32_t generation, std::shared_ptr<game> joined) {
+  route({ task::type::join_game, fd, generation, {}, std::move(joined) });
+}
+void big_poll::leave_game(int fd, uint32_t generation, std::shared_ptr<game> left) {
+  route({ task::type::leave_game, fd, generation, {}, std::move(left) });
+}
+void big_poll::left_queue(int fd, uint32_t generation) {
+  route({ task::type::left_queue, fd, generation, {}, nullptr });
+}
+void big_poll::route(task &&t) {
+  big_poll *owner = owner_of(t.fd, t.generation);
+  if (owner == nullptr) {
+    if (t.what == task::type::join_game) { lose_player(t.fd, t.match); }
+    return;
+  }
+  if (owner == current_reactor) {
+    owner->run_task(std::move(t));
+  } else {
+    owner->m_tasks.push(std::move(t));
+  }
+}
+void big_poll::lose_player(int fd, const std::shared_ptr<game> &g) {
+  std::unique_lock lock = g->lock();
+  if (g->is_over()) { return; }
+  game::player_input input;
+  input.fd = fd;
+  input.hung_up = true;
+  bool over = g->play_turn(input);
+  lock.unlock();
+  if (over) { end_game(g); }
+}
+void big_poll::end_game(const std::shared_ptr<game> &ended) {
+  //nothing is added to the list once the game is over, so it can be read without the lock
+  for (const game::leaving_player &player : ended->players_back_to_lobby()) {
+    leave_game(player.fd, player.generation, ended);
+  }
+}
+void big_poll::run_task(task &&t) {
+  if (t.what == task::type::drain) {
+    if (m_running == false || m_draining) { return; }
+    m_draining = true;
+    //new players go to the reactors of another server, the ones already here stay until their games end
+    if (m_io->close(m_listening_socket) == -1) { error_print("big_poll close listening socket"); }
+    m_events_size -= 1;
+    m_timers.arm(m_drain_timer, m_now + std::chrono::seconds(drain_seconds));
+    fprintf(stderr, "big_poll draining, %zu players still in games\n", m_players_in_game);
+    return;
+  }
+  if (t.what == task::type::shut_down) {
+    if (m_running) { stop(); }
+    return;
+  }
+  //the socket could have been closed (and its fd reused) since the task was made
+  if (is_own(t.fd, t.generation) == false) {
+    if (t.what == task::type::join_game) { lose_player(t.fd, t.match); }
+    return;
+  }
+  connection &c = connection::get(t.fd);
+  switch (t.what) {
+    case task::type::send:
+      if (io_backend::send_socket(t.fd, t.bytes.data(), t.bytes.size(), 0) == -1) { lose_socket(t.fd, true, errno); }
+      break;
+    case task::type::close:
+      //the game that asked for it is already done with the player
+      remove_disconnected_socket(t.fd);
+      break;
+    case task::type::join_game: {
+      set_state(c, connection::state::in_game);
+      c.current_game = std::move(t.match);
+      //only the socket's own reactor can be sure the fd is still logged in as the same user
+      std::unique_lock lock = c.current_game->lock();
+      c.current_game->seat_player(t.fd, user::get_username_by_fd(t.fd), user::get_rating_by_fd(t.fd));
+      lock.unlock();
+      arm_clock(t.fd);
+      //the game can be over already if the opponent left right away, and a frame that came while the player was being paired waited for it
+      if (leave_finished_game(t.fd)) { handle_frames(t.fd); }
+    } break;
+    case task::type::leave_game:
+      if (c.current == connection::state::in_game && c.current_game == t.match) { leave_finished_game(t.fd); }
+      break;
+    case task::type::left_queue:
+      if (c.current == connection::state::leaving_queue) {
+        std::span<const uint8_t> frame = *c.input.next_frame();
+        if (handle_queued_message(t.fd, static_cast<message>(frame[0]))) { handle_frames(t.fd); }
+      }
+      break;
+    case task::type::drain:
+    case task::type::shut_down:
+      //handled before the socket is looked up
+      break;
+  }
+}
+void big_poll::remove_disconnected_socket(int fd) {
+  user::disconnectUser(fd);
 
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, events[idx_to_remove].data.fd, NULL) == -1) { error_print("big_poll epoll_ctl remove disconnected client"); }
+  connection &c = connection::get(fd);
+  set_state(c, connection::state::lobby);
+  m_timers.cancel(c.idle_timer);
+  c.input.clear();
+  c.current_game.reset();
+  //anything still on its way to the socket is dropped from here on, even if the fd is reused right away
+  c.owner.store(nullptr);
+  c.generation += 1;
 
-  events_size -= 1;
+  m_events_size -= 1;
 
-  if (err != EBADFD) {
-    if (close(events[idx_to_remove].data.fd) == -1) { error_print("big_poll close disconnected client"); }
-  }
+  //closing takes it out of the backend too
+  if (io_backend::close_socket(fd) == -1) { error_print("big_poll close disconnected client"); }
 
-  fprintf(stderr, "disconnected socket %lu %d\n", idx_to_remove, events[idx_to_remove].data.fd);
+  fprintf(stderr, "disconnected socket %d\n", fd);
 }
-void big_poll::add_socket(int to_add) {
-  const std::lock_guard lock(mutex);
-
-  epoll_event ev;
-  ev.events = EPOLLIN | EPOLLET;
-  ev.data.fd = to_add;
+void big_poll::recv_send_fail_handler(int fd, std::string_view message, int err) {
+  error_print(message, err);
+  remove_disconnected_socket(fd);
+}
+void big_poll::register_socket(int to_add) {
+  //the fd limit can be past the table's cap, or raised after the table was sized
+  if (connection::fits(to_add) == false) {
+    fprintf(stderr, "socket %d doesn't fit in the connection table, closing it\n", to_add);
+    if (close(to_add) == -1) { error_print("big_poll close unregistered client"); }
+    return;
+  }
+  //a socket the backend doesn't watch would never get an event, or be reaped
+  if (m_io->add(to_add) == false) {
+    error_print("big_poll add client");
+    if (close(to_add) == -1) { error_print("big_poll close unregistered client"); }
+    return;
+  }
 
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, to_add, &ev) == -1) { error_print("epoll_ctl big_poll add client"); }
+  connection &c = connection::get(to_add);
+  c.idle_timer.fd = to_add;
+  c.clock_timer.fd = to_add;
+  set_state(c, connection::state::lobby);
+  c.owner.store(this);
 
-  events_size += 1;
-  if (events_size >= events_capacity) {
-    events_capacity *= 2;
-    events.reserve(events_capacity);
+  m_events_size += 1;
+  if (m_events_size >= m_events.size()) {
+    m_events.resize(m_events.size() * 2);
   }
   fprintf(stderr, "added new socket: %d\n", to_add);
 }
-int big_poll::get_listening_socket() {
-  return listening_socket;
-}
-void big_poll::set_listening_socket(int new_listening_socket) {
-  listening_socket = new_listening_socket;
-}
 void big_poll::poll_users() {
-  epoll_fd = epoll_create1(0);
-  if (epoll_fd == -1) {
-    error_print("big_poll epoll_create");
+  current_reactor = this;
+  m_io = io_backend::create(m_backend_kind);
+  if (m_io == nullptr) {
+    fprintf(stderr, "big_poll couldn't create an io backend\n");
+    finish();
     return;
   }
+  fprintf(stderr, "big_poll reactor running on %s\n", m_io->name());
 
-  epoll_event ev;
-  ev.events = EPOLLIN;
-  ev.data.fd = listening_socket;
+  if (m_io->add_listener(m_listening_socket) == false) {
+    error_print("big_poll add server");
+    finish();
+    return;
+  }
 
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listening_socket, &ev) == -1) {
-    error_print("big_poll epoll_ctl add server");
+  //other threads never touch the backend, they push tasks and its eventfd wakes this one up
+  if (m_io->add_wakeup(m_tasks.fd()) == false) {
+    error_print("big_poll add tasks");
+    finish();
     return;
   }
 
-  events.reserve(events_capacity);
+  //every timer of the reactor is in the wheel, the timerfd is only ever set to the wheel's next expiry
+  m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (m_timer_fd == -1 || m_io->add_wakeup(m_timer_fd) == false) {
+    error_print("big_poll add timers");
+    finish();
+    return;
+  }
+  m_events_size += 1;
 
-  while (true) {
-    int nfds;
-    {
-      std::lock_guard lock(mutex);
-      while ((nfds = epoll_wait(epoll_fd, events.data(), events_size, 500)) == -1 && errno == EINTR) {}
-    }
+  while (m_running) {
+    int nfds = m_io->wait(m_events);
     if (nfds == -1) {
-      error_print("big_poll epoll_wait");
-      continue;
-    }
-    if (nfds == 0) {
-      //sleep here otherwise u can't add sockets from outside this thread (yea ik, kinda sucky)
-      usleep(500000);
+      if (errno != EINTR) { error_print("big_poll wait"); }
       continue;
     }
+    m_now = timing_wheel::clock::now();
     fprintf(stderr, "no longer waiting, found %d readable sockets\n", nfds);
-    //big poll has automatic unique ownership over the file descriptors returned by epoll_wait
-    //other threads can only add file descriptors to the poll, only big_poll can remove them
-    //no need for a lock here, me thinks
+    //every reactor has automatic unique ownership over the file descriptors its backend reports
+    //tasks are run last, accepting or closing a socket can't move m_events around while it's being walked then
+    bool tasks_ready = false;
+    bool timers_ready = false;
     for (size_t i = 0; i < (size_t)nfds; i += 1) {
-      if (events[i].data.fd == listening_socket) {
-        int conn_socket = accept(listening_socket, NULL, NULL);
-        if (conn_socket == -1) {
-          error_print("big_poll accept");
-          continue;
-        }
-        FlipSocketBlocking(conn_socket, false);
-        add_socket(conn_socket);
+      if (m_events[i].data.fd == m_tasks.fd()) {
+        tasks_ready = true;
+      } else if (m_events[i].data.fd == m_timer_fd) {
+        timers_ready = true;
+      } else if (m_events[i].data.fd == m_listening_socket) {
+        accept_connections();
       } else {
-        if (events[i].events & (EPOLLPRI | EPOLLERR | EPOLLRDHUP | EPOLLHUP)) {
-          remove_disconnected_socket(i);
-        } else if (events[i].events & EPOLLIN) {
-          read_message(i);
+        //frames sent right before a hangup are still handled, the hangup itself shows up when reading
+        if (m_events[i].events & EPOLLIN) {
+          read_messages(m_events[i].data.fd);
+        } else if (m_events[i].events & (EPOLLPRI | EPOLLERR | EPOLLRDHUP | EPOLLHUP)) {
+          lose_socket(m_events[i].data.fd, false);
         }
       }
     }
+    if (tasks_ready) {
+      m_tasks.drain([this](task &&t) { run_task(std::move(t)); });
+    }
+    if (timers_ready) { run_timers(); }
+    if (m_running && m_draining && m_players_in_game == 0) { stop(); }
+    schedule_timers();
   }
+  finish();
 }
-void big_poll::read_message(size_t idx_to_read) {
-  bool logged_in = user::isActiveUser(events[idx_to_read].data.fd);
-
-  message m, to_send;
-
-  ssize_t recv_retval = recv(events[idx_to_read].data.fd, &m, sizeof(message), 0);
-  if (recv_retval == -1 || recv_retval == 0) {
-    if (recv_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll message recv"); }
-    else { remove_disconnected_socket(idx_to_read); }
+void big_poll::finish() {
+  m_running = false;
+  m_io.reset();
+  if (m_timer_fd != -1 && close(m_timer_fd) == -1) { error_print("big_poll close timerfd"); }
+  fprintf(stderr, "big_poll reactor stopped\n");
+  if (running_reactors.fetch_sub(1) == 1) {
+    uint64_t one = 1;
+    if (write(stopped_eventfd, &one, sizeof(one)) == -1) { error_print("big_poll stopped eventfd write"); }
+  }
+}
+void big_poll::stop() {
+  m_running = false;
+  if (m_draining == false) {
+    if (m_io->close(m_listening_socket) == -1) { error_print("big_poll close listening socket"); }
+    m_events_size -= 1;
+  }
+  for (int fd : connection::owned_by(this)) {
+    //closing one player can close its opponent, if that one lives here it's already gone
+    if (connection::get(fd).owner.load() == this) { lose_socket(fd, false); }
+  }
+}
+void big_poll::set_state(connection &c, connection::state next) {
+  if (c.current == connection::state::in_game) {
+    m_players_in_game -= 1;
+    m_timers.cancel(c.clock_timer);
+  }
+  //players in games are timed by their clocks, the lobby and the queue by the idle timeout
+  if (next == connection::state::in_game) {
+    m_players_in_game += 1;
+    m_timers.cancel(c.idle_timer);
+  } else if (idle_timeout.count() > 0) {
+    m_timers.arm(c.idle_timer, m_now + idle_timeout);
+  }
+  c.current = next;
+  c.last_active = m_now;
+}
+void big_poll::run_timers() {
+  uint64_t expirations;
+  if (read(m_timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) { error_print("big_poll timerfd read"); }
+  m_timer_deadline.reset();
+  m_timers.advance(m_now, [this](timing_wheel::timer &expired) {
+    if (&expired == &m_drain_timer) {
+      fprintf(stderr, "big_poll drain deadline hit, %zu players still in games\n", m_players_in_game);
+      stop();
+    } else if (&expired == &connection::get(expired.fd).idle_timer) {
+      reap_if_idle(expired.fd);
+    } else {
+      play_clock(expired.fd);
+    }
+  });
+}
+void big_poll::schedule_timers() {
+  std::optional<timing_wheel::clock::time_point> next = m_timers.next_expiry();
+  if (next == m_timer_deadline) { return; }
+  m_timer_deadline = next;
+  //steady_clock is CLOCK_MONOTONIC, a zeroed it_value disarms the timerfd
+  itimerspec spec = {};
+  if (next.has_value()) {
+    std::chrono::nanoseconds since_boot = next->time_since_epoch();
+    spec.it_value.tv_sec = static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(since_boot).count());
+    spec.it_value.tv_nsec = static_cast<long>((since_boot % std::chrono::seconds(1)).count());
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) { spec.it_value.tv_nsec = 1; }
+  }
+  if (timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) { error_print("big_poll timerfd_settime"); }
+}
+void big_poll::reap_if_idle(int fd) {
+  connection &c = connection::get(fd);
+  if (m_now - c.last_active < idle_timeout) {
+    m_timers.arm(c.idle_timer, c.last_active + idle_timeout);
     return;
   }
-
-  if (logged_in == false && (m == message::login_data || m == message::signup_data)) {
-    uint8_t username_length;
-    uint8_t password_length;
-    char username[256];
-    char password[256];
-    recv_retval = recv(events[idx_to_read].data.fd, &username_length, sizeof(username_length), 0);
-    if (recv_retval == -1 || recv_retval == 0) {
-      if (recv_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll username length recv"); }
-      else { remove_disconnected_socket(idx_to_read); }
-      return;
+  fprintf(stderr, "socket %d was idle for too long\n", fd);
+  lose_socket(fd, false);
+}
+void big_poll::arm_clock(int fd) {
+  connection &c = connection::get(fd);
+  std::unique_lock lock = c.current_game->lock();
+  std::optional<timing_wheel::clock::duration> left = c.current_game->time_left(fd);
+  lock.unlock();
+  if (left.has_value()) { m_timers.arm(c.clock_timer, timing_wheel::clock::now() + *left); }
+}
+void big_poll::play_clock(int fd) {
+  std::shared_ptr<game> g = connection::get(fd).current_game;
+  std::unique_lock lock = g->lock();
+  //the opponent's reactor ended the game, its leave_game task is on the way
+  if (g->is_over()) { return; }
+  //the timer only says when the clock can run out at the earliest, it can have been stopped since
+  std::optional<timing_wheel::clock::duration> left = g->time_left(fd);
+  if (left.has_value() == false) { return; }
+  if (left->count() > 0) {
+    lock.unlock();
+    arm_clock(fd);
+    return;
+  }
+  game::player_input input;
+  input.fd = fd;
+  input.flag_fell = true;
+  bool over = g->play_turn(input);
+  lock.unlock();
+  if (over) { end_game(g); }
+}
+void big_poll::accept_connections() {
+  //accepted sockets come out non blocking and with the listening socket's TCP_NODELAY, so there's nothing to set on them
+  while (true) {
+    int conn_socket = m_io->accept(m_listening_socket);
+    if (conn_socket == -1) {
+      //the connection was dropped while it waited in the backlog, the next one might be fine
+      if (errno == ECONNABORTED || errno == EINTR) { continue; }
+      if (errno != EAGAIN && errno != EWOULDBLOCK) { error_print("big_poll accept"); }
+      break;
     }
-    recv_retval = recv(events[idx_to_read].data.fd, &password_length, sizeof(password_length), 0);
-    if (recv_retval == -1 || recv_retval == 0) {
-      if (recv_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll password length recv"); }
-      else { remove_disconnected_socket(idx_to_read); }
-      return;
+    register_socket(conn_socket);
+  }
+}
+void big_poll::read_messages(int fd) {
+  connection &c = connection::get(fd);
+  frame_reader::state input_state = c.input.fill(fd);
+  int recv_errno = errno;
+  c.last_active = m_now;
+
+  //everything that arrived whole is handled, even if the socket closed right after sending it
+  if (handle_frames(fd) == false) { return; }
+
+  if (input_state == frame_reader::state::closed) {
+    lose_socket(fd, false);
+  } else if (input_state == frame_reader::state::failed) {
+    lose_socket(fd, true, recv_errno);
+  }
+}
+bool big_poll::handle_frames(int fd) {
+  connection &c = connection::get(fd);
+  uint32_t generation = c.generation.load();
+  while (std::optional<std::span<const uint8_t>> frame = c.input.peek_frame()) {
+    switch (c.current) {
+      case connection::state::lobby:
+        c.input.next_frame();
+        if (handle_message(fd, *frame) == false) { return false; }
+        break;
+      case connection::state::queued:
+        //the frame waits for the queue to take the player out, or for the game if it was paired already
+        set_state(c, connection::state::leaving_queue);
+        player_queue::remove_socket(fd, generation);
+        return true;
+      case connection::state::leaving_queue:
+        return true;
+      case connection::state::in_game:
+        if (play_next_frame(fd) == false && leave_finished_game(fd) == false) { return false; }
+        if (c.generation.load() != generation) { return false; }
+        break;
     }
-    recv_retval = recv(events[idx_to_read].data.fd, username, username_length, 0);
-    if (recv_retval == -1 || recv_retval == 0) {
-      if (recv_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll username recv"); }
-      else { remove_disconnected_socket(idx_to_read); }
-      return;
+  }
+  return true;
+}
+bool big_poll::play_next_frame(int fd) {
+  connection &c = connection::get(fd);
+  //the reactor's own reference, the game can close the socket (and drop the connection's) while it plays
+  std::shared_ptr<game> g = c.current_game;
+  std::unique_lock lock = g->lock();
+  if (g->is_over()) { return false; }
+  std::span<const uint8_t> frame = *c.input.next_frame();
+  game::player_input input;
+  input.fd = fd;
+  input.m = static_cast<message>(frame[0]);
+  if (input.m == message::move) { memcpy(input.moveset.data(), frame.data() + sizeof(message), 3 * sizeof(uint8_t)); }
+  bool over = g->play_turn(input);
+  lock.unlock();
+  if (over) { end_game(g); }
+  return true;
+}
+bool big_poll::play_loss(int fd, bool failed, int err) {
+  std::shared_ptr<game> g = connection::get(fd).current_game;
+  std::unique_lock lock = g->lock();
+  if (g->is_over()) { return false; }
+  game::player_input input;
+  input.fd = fd;
+  input.hung_up = !failed;
+  input.recv_failed = failed;
+  input.recv_errno = err;
+  bool over = g->play_turn(input);
+  lock.unlock();
+  if (over) { end_game(g); }
+  return true;
+}
+bool big_poll::leave_finished_game(int fd) {
+  connection &c = connection::get(fd);
+  std::shared_ptr<game> g = c.current_game;
+  std::unique_lock lock = g->lock();
+  if (g->is_over() == false) { return true; }
+  const std::vector<game::leaving_player> &leaving = g->players_back_to_lobby();
+  auto it = std::find_if(leaving.begin(), leaving.end(), [&](const game::leaving_player &player) { return player.fd == fd && player.generation == c.generation.load(); });
+  bool back_to_lobby = it != leaving.end();
+  bool drop_next_frame = back_to_lobby && it->drop_next_frame;
+  std::optional<rating> new_rating = g->rating_after(fd);
+  lock.unlock();
+
+  set_state(c, connection::state::lobby);
+  c.current_game.reset();
+  if (back_to_lobby == false) {
+    //the game closed the player from another reactor, its close is still on the way
+    remove_disconnected_socket(fd);
+    return false;
+  }
+  //the next time it's queued it's with the new rating, users.txt gets it from the writer
+  if (new_rating.has_value()) { user::set_rating_by_fd(fd, *new_rating); }
+  if (drop_next_frame && c.input.next_frame().has_value()) {
+    fprintf(stderr, "dropped the frame socket %d sent before its game ended\n", fd);
+  }
+  fprintf(stderr, "socket %d is back in the lobby\n", fd);
+  return true;
+}
+void big_poll::lose_socket(int fd, bool failed, int err) {
+  connection &c = connection::get(fd);
+  if (c.current == connection::state::in_game) {
+    //the game closes it and tells the opponent
+    if (play_loss(fd, failed, err)) { return; }
+    if (leave_finished_game(fd) == false) { return; }
+  }
+  if (c.current == connection::state::queued || c.current == connection::state::leaving_queue) {
+    //if it was paired already, its game finds it gone
+    player_queue::remove_socket(fd, c.generation.load());
+  }
+  if (failed) {
+    recv_send_fail_handler(fd, "big_poll message recv", err);
+  } else {
+    remove_disconnected_socket(fd);
+  }
+}
+bool big_poll::handle_queued_message(int fd, message m) {
+  if (m == message::abort_match) {
+    set_state(connection::get(fd), connection::state::lobby);
+
+    message to_send = message::confirmation;
+    ssize_t send_retval = io_backend::send_socket(fd, &to_send, sizeof(message), 0);
+    if (send_retval == -1 || send_retval == 0) {
+      if (send_retval == -1) { recv_send_fail_handler(fd, "big_poll abort_search confirmation send"); }
+      else { remove_disconnected_socket(fd); }
+      return false;
     }
-    recv_retval = recv(events[idx_to_read].data.fd, password, password_length, 0);
-    if (recv_retval == -1 || recv_retval == 0) {
-      if (recv_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll password recv"); }
-      else { remove_disconnected_socket(idx_to_read); }
-      return;
+    fprintf(stderr, "aborted match search for socket %d\n", fd);
+    return true;
+  }
+  //if recieved_message is not valid, it means that the client is compromised and should be removed
+  std::cerr << "(command: " << get_message_as_text(m) << ") ";
+  fprintf(stderr, "disconnecting queued socket %d\n", fd);
+  if (m == message::quit) {
+    message to_send = message::confirmation;
+    ssize_t send_retval = io_backend::send_socket(fd, &to_send, sizeof(message), 0);
+    if (send_retval == -1 || send_retval == 0) {
+      if (send_retval == -1) { recv_send_fail_handler(fd, "big_poll queued quit confirmation send"); }
+      else { remove_disconnected_socket(fd); }
+      return false;
     }
+    fprintf(stderr, "exited socket %d\n", fd);
+  }
+  remove_disconnected_socket(fd);
+  return false;
+}
+bool big_poll::handle_message(int fd, std::span<const uint8_t> frame) {
+  bool logged_in = user::isActiveUser(fd);
+
+  message m = static_cast<message>(frame[0]), to_send;
+
+  if (logged_in == false && (m == message::login_data || m == message::signup_data)) {
+    uint8_t username_length = frame[1];
+    uint8_t password_length = frame[2];
+    std::string_view username(reinterpret_cast<const char *>(frame.data()) + 3, username_length);
+    std::string_view password(reinterpret_cast<const char *>(frame.data()) + 3 + username_length, password_length);
 
     bool result;
     if (m == message::login_data) {
-      result = user::getAcount(events[idx_to_read].data.fd, std::string_view(username, username_length), std::string_view(password, password_length));
+      result = user::getAcount(fd, username, password);
     } else {
-      result = user::createAccount(events[idx_to_read].data.fd, std::string_view(username, username_length), std::string_view(password, password_length));
+      result = user::createAccount(fd, username, password);
     }
 
     if (result == false) {
@@ -193,61 +578,75 @@ void big_poll::read_message(size_t idx_to_read) {
       to_send = message::confirmation;
     }
     
-    ssize_t send_retval = send(events[idx_to_read].data.fd, &to_send, sizeof(message), 0);
+    ssize_t send_retval = io_backend::send_socket(fd, &to_send, sizeof(message), 0);
     if (send_retval == -1 || send_retval == 0) {
-      if (send_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll respoonse send"); }
-      else { remove_disconnected_socket(idx_to_read); }
-      return;
+      if (send_retval == -1) { recv_send_fail_handler(fd, "big_poll respoonse send"); }
+      else { remove_disconnected_socket(fd); }
+      return false;
     }
 
-    fprintf(stderr, "login/registration %s for socket %lu %d\n", result ? "successful" : "failed", idx_to_read, events[idx_to_read].data.fd);
+    fprintf(stderr, "login/registration %s for socket %d\n", result ? "successful" : "failed", fd);
   } else if (logged_in == true && (m == message::play || m == message::logout || m == message::delete_account)) {
     if (m == message::play) {
-      remove_socket(idx_to_read);
-
-      player_queue::add_socket(events[idx_to_read].data.fd);
+      //the socket stays right here, frames it sends while queued are handled by handle_queued_message
+      connection &c = connection::get(fd);
+      if (player_queue::add_socket(fd, c.generation.load())) {
+        set_state(c, connection::state::queued);
+      } else {
+        //the server is going away, no game would start
+        to_send = message::rejection;
+        ssize_t send_retval = io_backend::send_socket(fd, &to_send, sizeof(message), 0);
+        if (send_retval == -1 || send_retval == 0) {
+          if (send_retval == -1) { recv_send_fail_handler(fd, "big_poll logged_in play rejection send"); }
+          else { remove_disconnected_socket(fd); }
+          return false;
+        }
+        fprintf(stderr, "not queueing socket %d, the queue is stopped\n", fd);
+      }
     } else if (m == message::logout) {
-      user::disconnectUser(events[idx_to_read].data.fd);
+      user::disconnectUser(fd);
 
       to_send = message::confirmation;
-      ssize_t send_retval = send(events[idx_to_read].data.fd, &to_send, sizeof(message), 0);
+      ssize_t send_retval = io_backend::send_socket(fd, &to_send, sizeof(message), 0);
       if (send_retval == -1 || send_retval == 0) {
-        if (send_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll logged_in logout send"); }
-        else { remove_disconnected_socket(idx_to_read); }
-        return;
+        if (send_retval == -1) { recv_send_fail_handler(fd, "big_poll logged_in logout send"); }
+        else { remove_disconnected_socket(fd); }
+        return false;
       }
-      fprintf(stderr, "logged out socket %lu %d\n", idx_to_read, events[idx_to_read].data.fd);
+      fprintf(stderr, "logged out socket %d\n", fd);
     } else if (m == message::delete_account) {
-      bool result = user::deleteAccount(events[idx_to_read].data.fd);
+      bool result = user::deleteAccount(fd);
       if (result == false) {
         to_send = message::rejection;
       } else {
         to_send = message::confirmation;
       }
 
-      ssize_t send_retval = send(events[idx_to_read].data.fd, &to_send, sizeof(message), 0);
+      ssize_t send_retval = io_backend::send_socket(fd, &to_send, sizeof(message), 0);
       if (send_retval == -1 || send_retval == 0) {
-        if (send_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll logged_in account deletion response send"); }
-        else { remove_disconnected_socket(idx_to_read); }
-        return;
+        if (send_retval == -1) { recv_send_fail_handler(fd, "big_poll logged_in account deletion response send"); }
+        else { remove_disconnected_socket(fd); }
+        return false;
       }
 
-      fprintf(stderr, "account deletion %s for socket %lu %d\n", result ? "successful" : "failed", idx_to_read, events[idx_to_read].data.fd);
+      fprintf(stderr, "account deletion %s for socket %d\n", result ? "successful" : "failed", fd);
     }
   } else {
     //if recieved_message is not valid, it means that the client is compromised and should be removed
     std::cerr << "(command: " << get_message_as_text(m) << ") ";
-    fprintf(stderr, "disconnecting socket %lu %d\n", idx_to_read, events[idx_to_read].data.fd);
+    fprintf(stderr, "disconnecting socket %d\n", fd);
     if (m == message::quit) {
       to_send = message::confirmation;
-      ssize_t send_retval = send(events[idx_to_read].data.fd, &to_send, sizeof(message), 0);
+      ssize_t send_retval = io_backend::send_socket(fd, &to_send, sizeof(message), 0);
       if (send_retval == -1 || send_retval == 0) {
-        if (recv_retval == -1) { recv_send_fail_handler(idx_to_read, "big_poll quit confirmation send"); }
-        else { remove_disconnected_socket(idx_to_read); }
-        return;
+        if (send_retval == -1) { recv_send_fail_handler(fd, "big_poll quit confirmation send"); }
+        else { remove_disconnected_socket(fd); }
+        return false;
       }
-      fprintf(stderr, "exited socket %lu %d\n", idx_to_read, events[idx_to_read].data.fd);
+      fprintf(stderr, "exited socket %d\n", fd);
     }
-    remove_disconnected_socket(idx_to_read);
+    remove_disconnected_socket(fd);
+    return false;
   }
+  return true;
 }
@@ -1,33 +1,151 @@
 #pragma once
 
+#include "handoff_queue.h"
+#include "io_backend.h"
+#include "game.h"
+#include "connection.h"
+#include "timing_wheel.h"
+
 #include <sys/epoll.h>
 
+#include <atomic>
+#include <chrono>
+#include <optional>
 #include <vector>
-#include <mutex>
+#include <memory>
+#include <span>
+#include <thread>
 
+// the reactors every client socket lives in, each owning a listening socket (bound with SO_REUSEPORT), an io backend and the sockets accepted on it
+// a socket stays in the reactor that accepted it until it's closed, going through the lobby, the queue and games only changes its connection state
+// other threads never touch a reactor's sockets, whatever they have for one (a reply, a close, a game to join) goes through the reactor's tasks
 class big_poll {
 public:
-  static void add_socket(int);
-  static int get_listening_socket();
-  static void set_listening_socket(int);
-  static void poll_users();
-private:
-  big_poll() = delete;
+  // starts one reactor thread per listening socket, has to be called once before anything else
+  // sockets that stay in the lobby or the queue without sending anything for the passed time are closed, never if it's 0
+  static void start(const std::vector<int> &, io_backend::kind, std::chrono::seconds);
+  // the reactors stop accepting and wait for the games their players are in to end, or for the passed number of seconds,
+  // then close every socket they have and stop
+  static void drain(unsigned);
+  // the reactors close every socket they have and stop, without waiting for games
+  static void shut_down();
+  // readable once every reactor has stopped
+  static int stopped_fd();
+  static void join();
+  // these take the socket's fd and the generation of its connection, and do nothing if the socket was closed since
+  // called on the socket's own reactor they happen right away, from anywhere else they are queued for it
+  // queued sends count as sent, if they fail later the reactor plays it like a hangup
+  static ssize_t send_socket(int, uint32_t, const void *, size_t);
+  static void close_socket(int, uint32_t);
+  // moves a player that was taken out of the queue into the game
+  static void join_game(int, uint32_t, std::shared_ptr<game>);
+  // moves a player the game is over for back to the lobby
+  static void leave_game(int, uint32_t, std::shared_ptr<game>);
+  // the queue took the player out before it was paired, the frame it sent while queued can be handled now
+  static void left_queue(int, uint32_t);
+
   big_poll(const big_poll &) = delete;
   big_poll(big_poll &&) = delete;
   big_poll &operator = (const big_poll &) = delete;
   big_poll &operator = (big_poll &&) = delete;
   ~big_poll() = delete;
+private:
+  struct task {
+    enum class type : uint8_t {
+      send,
+      close,
+      join_game,
+      leave_game,
+      left_queue,
+      // not about one socket, the fd isn't used
+      drain,
+      shut_down,
+    };
+    type what;
+    int fd;
+    uint32_t generation;
+    std::vector<uint8_t> bytes;
+    std::shared_ptr<game> match;
+  };
+
+  big_poll(int, io_backend::kind);
+
+  // the reactor the socket lives in, nullptr if the generation is stale
+  static big_poll *owner_of(int, uint32_t);
+  // runs the task on the socket's reactor, right away if that's the calling thread
+  static void route(task &&);
+  // the player left before its reactor could put it in the game, which plays that like a hangup
+  static void lose_player(int, const std::shared_ptr<game> &);
+  // moves the players the game sent back to the lobby once it's over
+  static void end_game(const std::shared_ptr<game> &);
+
+  void poll_users();
+  // adds the socket to the backend and the connection table, only called on the reactor's own thread
+  void register_socket(int);
+  // accepts until the backlog is empty
+  void accept_connections();
+  void run_task(task &&);
+  // keeps the count of players in games up to date
+  void set_state(connection &, connection::state);
+  // closes every socket like it hung up (so games tell the opponents) and makes the loop end
+  void stop();
+  // frees the backend and tells stopped_fd the reactor is done, the last thing the reactor's thread does
+  void finish();
+  // runs whatever expired in the wheel
+  void run_timers();
+  // sets the timerfd to the wheel's next expiry, if that changed
+  void schedule_timers();
+  // closes the socket if it didn't send anything for idle_timeout, or checks again once it could have
+  void reap_if_idle(int);
+  // sets the player's clock timer to when its clock would run out if it were its turn right now
+  void arm_clock(int);
+  // the player's clock timer expired, the player loses if its clock really ran out
+  void play_clock(int);
+  bool is_own(int, uint32_t) const;
+  // drains the socket and handles every whole frame that came with it
+  void read_messages(int);
+  // handles whole frames until one can't be handled yet, returns false once the socket was closed
+  bool handle_frames(int);
+  // these return false once the socket was closed
+  bool handle_message(int, std::span<const uint8_t>);
+  bool handle_queued_message(int, message);
+  // play the socket's next frame, or its loss, in its game
+  // false if the game was already over (the opponent's reactor ended it), nothing is played then
+  bool play_next_frame(int);
+  bool play_loss(int, bool, int);
+  // moves the socket back to the lobby if its game is over, returns false if the game closed it instead
+  bool leave_finished_game(int);
+  // the socket hung up, or reading from or writing to it failed (with the passed errno)
+  void lose_socket(int, bool, int = 0);
+  void remove_disconnected_socket(int);
+  void recv_send_fail_handler(int, std::string_view, int = errno);
+
+  // never resized after start, reactors live as long as the process does
+  static std::vector<big_poll *> reactors;
+  static std::vector<std::thread> threads;
+  static std::atomic<size_t> running_reactors;
+  static int stopped_eventfd;
+  // set before the drain tasks are pushed
+  static unsigned drain_seconds;
+  static std::chrono::seconds idle_timeout;
 
-  static void read_message(size_t);
-  static void remove_disconnected_socket(size_t);
-  static void remove_socket(size_t);
-  static void recv_send_fail_handler(size_t, std::string_view);
-
-  static int listening_socket;
-  static int epoll_fd;
-  static std::vector<epoll_event> events;
-  static size_t events_capacity;
-  static size_t events_size;
-  static std::mutex mutex;
+  int m_listening_socket;
+  io_backend::kind m_backend_kind;
+  // created on the reactor's own thread
+  std::unique_ptr<io_backend> m_io;
+  std::vector<epoll_event> m_events;
+  // sockets in the backend, the listening socket, the tasks eventfd and the timerfd included
+  size_t m_events_size;
+  handoff_queue<task> m_tasks;
+  bool m_running = true;
+  bool m_draining = false;
+  size_t m_players_in_game = 0;
+  // taken once per loop, when the wait returned
+  timing_wheel::clock::time_point m_now;
+  timing_wheel m_timers { std::chrono::milliseconds(10) };
+  // armed once the reactor starts draining
+  timing_wheel::timer m_drain_timer;
+  int m_timer_fd = -1;
+  // what the timerfd is set to, nullopt if it's disarmed
+  std::optional<timing_wheel::clock::time_point> m_timer_deadline;
 };
@@ -0,0 +1,83 @@
+#include "bitboard.h"
+
+std::array<magic, 64> attacks::rook_magics;
+std::array<magic, 64> attacks::bishop_magics;
+std::array<bitboard, 0x19000> attacks::rook_table;
+std::array<bitboard, 0x1480> attacks::bishop_table;
+
+namespace {
+  // xorshift64star, only used to look for magic numbers
+  class magic_prng {
+  public:
+    magic_prng(uint64_t seed) : m_state(seed) {}
+    uint64_t rand() {
+      m_state ^= m_state >> 12;
+      m_state ^= m_state << 25;
+      m_state ^= m_state >> 27;
+      return m_state * 2685821657736338717ULL;
+    }
+    // magics with few set bits are found a lot faster
+    uint64_t sparse_rand() {
+      return rand() & rand() & rand();
+    }
+  private:
+    uint64_t m_state;
+  };
+
+  bitboard row_bb(uint8_t row) {
+    return bitboard(0xFF) << (row * 8);
+  }
+  bitboard collumn_bb(uint8_t collumn) {
+    return bitboard(0x0101010101010101) << collumn;
+  }
+}
+
+template <size_t N>
+void attacks::init_magics(std::array<magic, 64> &magics, bitboard *table, const std::array<step, N> &directions) {
+  //seeds that find every magic quickly, one per row
+  static const std::array<uint64_t, 8> seeds = { 728, 10316, 55013, 32803, 12281, 15100, 16645, 255 };
+  //scratch space for the biggest possible mask (a rook in a corner, 12 relevant squares)
+  static std::array<bitboard, 4096> occupancies, references;
+  static std::array<unsigned, 4096> epochs;
+  unsigned epoch = 0;
+  size_t size = 0;
+
+  for (uint8_t square = 0; square < 64; square += 1) {
+    magic &m = magics[square];
+    //pieces on the edge of the board never block anything, so they are left out of the mask
+    bitboard edges = ((row_bb(0) | row_bb(7)) & ~row_bb(square / 8)) | ((collumn_bb(0) | collumn_bb(7)) & ~collumn_bb(square % 8));
+    m.mask = sliding_attacks(square, 0, directions) & ~edges;
+    m.shift = static_cast<uint8_t>(64 - popcount(m.mask));
+    m.attacks = square == 0 ? table : magics[square - 1].attacks + size;
+
+    //carry-rippler, walks every subset of the mask
+    size = 0;
+    bitboard b = 0;
+    do {
+      occupancies[size] = b;
+      references[size] = sliding_attacks(square, b, directions);
+      size += 1;
+      b = (b - m.mask) & m.mask;
+    } while (b);
+
+    magic_prng prng(seeds[square / 8]);
+    for (size_t i = 0; i < size; ) {
+      for (m.number = 0; popcount((m.number * m.mask) >> 56) < 6; ) { m.number = prng.sparse_rand(); }
+      //epochs avoid clearing the attack slice after every failed attempt
+      epoch += 1;
+      for (i = 0; i < size; i += 1) {
+        size_t idx = m.index(occupancies[i]);
+        if (epochs[idx] < epoch) {
+          epochs[idx] = epoch;
+          m.attacks[idx] = references[i];
+        } else if (m.attacks[idx] != references[i]) {
+          break;
+        }
+      }
+    }
+  }
+}
+void attacks::init() {
+  init_magics(rook_magics, rook_table.data(), rook_directions);
+  init_magics(bishop_magics, bishop_table.data(), bishop_directions);
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "../../common/utils.h"
+
+#include <stdint.h>
+
+#include <array>
+
+// squares are numbered x * 8 + y, the same way coords index the board (x is the row, y is the collumn)
+using bitboard = uint64_t;
+
+constexpr bitboard square_bb(uint8_t square) {
+  return bitboard(1) << square;
+}
+constexpr uint8_t popcount(bitboard b) {
+  return static_cast<uint8_t>(__builtin_popcountll(b));
+}
+// b must not be empty
+constexpr uint8_t lsb(bitboard b) {
+  return static_cast<uint8_t>(__builtin_ctzll(b));
+}
+// removes the least significant square from b and returns it, b must not be empty
+constexpr uint8_t pop_lsb(bitboard &b) {
+  uint8_t square = lsb(b);
+  b &= b - 1;
+  return square;
+}
+inline uint8_t to_square(coords c) {
+  return static_cast<uint8_t>(c.x * 8 + c.y);
+}
+inline coords to_coords(uint8_t square) {
+  return coords(square / 8, square % 8);
+}
+
+// (row, collumn) offsets, only ever walked at compile time or while the magics are searched for
+using step = std::array<int, 2>;
+constexpr std::array<step, 8> knight_steps     = { step({ -2,  1 }), step({ -1,  2 }), step({  1,  2 }), step({  2,  1 }), step({  2, -1 }), step({  1, -2 }), step({ -1, -2 }), step({ -2, -1 }) };
+constexpr std::array<step, 4> rook_directions   = { step({ -1,  0 }), step({  0,  1 }), step({  1,  0 }), step({  0, -1 }) };
+constexpr std::array<step, 4> bishop_directions = { step({ -1,  1 }), step({  1,  1 }), step({  1, -1 }), step({ -1, -1 }) };
+constexpr std::array<step, 8> queen_directions  = { step({ -1,  0 }), step({ -1,  1 }), step({  0,  1 }), step({  1,  1 }), step({  1,  0 }), step({  1, -1 }), step({  0, -1 }), step({ -1, -1 }) };
+
+// the square one step away, or nothing if that falls off the board
+constexpr bitboard shifted(uint8_t square, step s) {
+  const int x = square / 8 + s[0];
+  const int y = square % 8 + s[1];
+  return (x >= 0 && x < 8 && y >= 0 && y < 8) ? square_bb(static_cast<uint8_t>(x * 8 + y)) : 0;
+}
+template <size_t N>
+constexpr bitboard step_attacks(uint8_t square, const std::array<step, N> &steps) {
+  bitboard retval = 0;
+  for (step s : steps) { retval |= shifted(square, s); }
+  return retval;
+}
+// walks every direction until it falls off the board or hits something in occupancy (which is included)
+template <size_t N>
+constexpr bitboard sliding_attacks(uint8_t square, bitboard occupancy, const std::array<step, N> &directions) {
+  bitboard retval = 0;
+  for (step s : directions) {
+    for (bitboard b = shifted(square, s); b; b = shifted(lsb(b), s)) {
+      retval |= b;
+      if (occupancy & b) { break; }
+    }
+  }
+  return retval;
+}
+template <size_t N>
+constexpr std::array<bitboard, 64> make_step_table(const std::array<step, N> &steps) {
+  std::array<bitboard, 64> retval {};
+  for (uint8_t square = 0; square < 64; square += 1) { retval[square] = step_attacks(square, steps); }
+  return retval;
+}
+// between_table when between is true, line_table otherwise
+constexpr std::array<std::array<bitboard, 64>, 64> make_ray_table(bool between) {
+  std::array<std::array<bitboard, 64>, 64> retval {};
+  for (uint8_t from = 0; from < 64; from += 1) {
+    for (step s : queen_directions) {
+      const bitboard full_line = sliding_attacks(from, 0, std::array<step, 2>({ s, step({ -s[0], -s[1] }) })) | square_bb(from);
+      bitboard passed = 0;
+      for (bitboard b = shifted(from, s); b; b = shifted(lsb(b), s)) {
+        retval[from][lsb(b)] = between ? passed : full_line;
+        passed |= b;
+      }
+    }
+  }
+  return retval;
+}
+
+// fancy magic bitboards: the relevant blockers of a slider are multiplied by a per square magic number
+// and the top bits of the product index straight into that square's slice of the attack table
+struct magic {
+  bitboard mask;
+  bitboard number;
+  bitboard *attacks;
+  uint8_t shift;
+  size_t index(bitboard occupancy) const {
+    return static_cast<size_t>(((occupancy & mask) * number) >> shift);
+  }
+};
+
+class attacks {
+public:
+  // finds the magics and fills the slider tables, has to be called once before any board is used
+  static void init();
+
+  static constexpr bitboard knight(uint8_t square) { return knight_table[square]; }
+  static constexpr bitboard king(uint8_t square) { return king_table[square]; }
+  // squares attacked by a pawn of the passed colour standing on square
+  static constexpr bitboard pawn(color colour, uint8_t square) { return pawn_table[static_cast<bool>(colour)][square]; }
+  static bitboard rook(uint8_t square, bitboard occupancy) {
+    const magic &m = rook_magics[square];
+    return m.attacks[m.index(occupancy)];
+  }
+  static bitboard bishop(uint8_t square, bitboard occupancy) {
+    const magic &m = bishop_magics[square];
+    return m.attacks[m.index(occupancy)];
+  }
+  static bitboard queen(uint8_t square, bitboard occupancy) {
+    return rook(square, occupancy) | bishop(square, occupancy);
+  }
+  // squares strictly between the two squares if they share a row, collumn or diagonal, empty otherwise
+  static constexpr bitboard between(uint8_t from, uint8_t to) { return between_table[from][to]; }
+  // the whole row, collumn or diagonal going through both squares, empty if there is none
+  static constexpr bitboard line(uint8_t from, uint8_t to) { return line_table[from][to]; }
+private:
+  attacks() = delete;
+  attacks(const attacks &) = delete;
+  attacks(attacks &&) = delete;
+  attacks &operator = (const attacks &) = delete;
+  attacks &operator = (attacks &&) = delete;
+  ~attacks() = delete;
+
+  template <size_t N>
+  static void init_magics(std::array<magic, 64> &, bitboard *, const std::array<step, N> &);
+
+  // leaper and ray tables are baked into the binary, only the magics are looked for at startup
+  static constexpr std::array<bitboard, 64> knight_table = make_step_table(knight_steps);
+  static constexpr std::array<bitboard, 64> king_table = make_step_table(queen_directions);
+  static constexpr std::array<std::array<bitboard, 64>, 2> pawn_table = { make_step_table(std::array<step, 2>({ step({ 1, -1 }), step({ 1, 1 }) })),
+                                                                          make_step_table(std::array<step, 2>({ step({ -1, -1 }), step({ -1, 1 }) })) };
+  static constexpr std::array<std::array<bitboard, 64>, 64> between_table = make_ray_table(true);
+  static constexpr std::array<std::array<bitboard, 64>, 64> line_table = make_ray_table(false);
+  static std::array<magic, 64> rook_magics;
+  static std::array<magic, 64> bishop_magics;
+  static std::array<bitboard, 0x19000> rook_table;
+  static std::array<bitboard, 0x1480> bishop_table;
+};
+
+static_assert(attacks::knight(0) == 0x0000000000020400, "a knight on the first square should reach the second and third rows only");
+static_assert(attacks::knight(36) == 0x0028440044280000, "a knight in the middle of the board should reach 8 squares");
+static_assert(attacks::king(63) == 0x40C0000000000000, "a king in the corner should reach 3 squares");
+static_assert(attacks::pawn(color::white, 8) == 0x0000000000020000 && attacks::pawn(color::black, 55) == 0x0000400000000000, "pawns should only take forwards and not wrap around the board");
+static_assert(attacks::between(0, 63) == 0x0040201008040200 && attacks::between(0, 17) == 0, "between should only cover aligned squares");
+static_assert(attacks::line(0, 7) == 0x00000000000000FF && attacks::line(4, 60) == 0x1010101010101010, "lines should span the whole board");
@@ -1,191 +1,711 @@
 #include "board.h"
 
-piece wp(piece_type p) {
-  return { p, color::white };
+#include <assert.h>
+
+namespace {
+  //expanded boards work in this one, reserved for the longest history the first time a thread expands a board
+  //the games themselves then only keep the keys
+  thread_local std::vector<uint64_t> expanded_history;
 }
-piece bp(piece_type p) {
-  return { p, color::black };
+
+color opposite(color c) {
+  return static_cast<color>(!static_cast<bool>(c));
 }
-std::optional<piece> none() {
-  return {};
+piece_type promoted_to(promotion p) {
+  switch (p) {
+    case promotion::knight: return knight;
+    case promotion::bishop: return bishop;
+    case promotion::rook: return rook;
+    default: return queen;
+  }
+}
+board::board() : m_pieces(), m_occupancy(), m_turn(color::white), m_en_passant_colllumn(std::nullopt), m_can_castle( {  std::array<bool, 2>( { true, true } ), std::array<bool, 2>( { true, true } ) } ), m_king_coords( { coords(0, 4), coords(7, 4) } ), m_hash(0), m_halfmove_clock(0), m_fullmove_number(1) {
+  static const std::array<piece_type, 8> back_row = { rook, knight, bishop, queen, king, bishop, knight, rook };
+  m_squares.fill(no_piece);
+  for (uint8_t y = 0; y < 8; y += 1) {
+    put_piece(to_square(coords(0, y)), piece_index(color::white, back_row[y]));
+    put_piece(to_square(coords(1, y)), piece_index(color::white, pawn));
+    put_piece(to_square(coords(6, y)), piece_index(color::black, pawn));
+    put_piece(to_square(coords(7, y)), piece_index(color::black, back_row[y]));
+  }
+  m_hash = compute_hash();
+  m_history.reserve(max_history);
+  record_position();
+}
+board::board(const packed_board &packed, const std::vector<uint64_t> &history) : m_pieces(), m_occupancy(), m_hash(0), m_history(std::move(expanded_history)) {
+  //only allocates the first time on a thread, or while another board of the thread is expanded
+  m_history.reserve(max_history);
+  m_history.assign(history.begin(), history.end());
+  m_squares.fill(no_piece);
+  bitboard occupancy = packed.occupancy;
+  //load_fen never takes more pieces than fit, and moves can only take pieces away
+  assert(popcount(occupancy) <= 32);
+  for (size_t i = 0; occupancy; i += 1) {
+    const uint8_t square = pop_lsb(occupancy);
+    const uint8_t index = (packed.pieces[i / 2] >> ((i % 2) * 4)) & 0x0F;
+    put_piece(square, index);
+    if (index % 6 == king) { m_king_coords[index / 6] = to_coords(square); }
+  }
+  m_turn = static_cast<color>(packed.header & 1);
+  for (size_t c = 0; c < 2; c += 1) {
+    for (size_t side = 0; side < 2; side += 1) {
+      m_can_castle[c][side] = (packed.header >> (1 + c * 2 + side)) & 1;
+    }
+  }
+  m_en_passant_colllumn.reset();
+  if ((packed.header >> 5) & 1) { m_en_passant_colllumn = (packed.header >> 6) & 0x07; }
+  m_halfmove_clock = static_cast<uint16_t>(packed.header >> 16);
+  m_fullmove_number = static_cast<uint16_t>(packed.header >> 32);
+  m_hash = compute_hash();
+}
+packed_board board::pack(std::vector<uint64_t> &history) {
+  packed_board packed;
+  packed.occupancy = m_occupancy[0] | m_occupancy[1];
+  packed.pieces.fill(0);
+  bitboard occupancy = packed.occupancy;
+  //load_fen never takes more pieces than fit, and moves can only take pieces away
+  assert(popcount(occupancy) <= 32);
+  for (size_t i = 0; occupancy; i += 1) {
+    packed.pieces[i / 2] |= static_cast<uint8_t>(m_squares[pop_lsb(occupancy)] << ((i % 2) * 4));
+  }
+  packed.header = static_cast<bool>(m_turn);
+  for (size_t c = 0; c < 2; c += 1) {
+    for (size_t side = 0; side < 2; side += 1) {
+      packed.header |= static_cast<uint64_t>(m_can_castle[c][side]) << (1 + c * 2 + side);
+    }
+  }
+  if (m_en_passant_colllumn) { packed.header |= (uint64_t(1) << 5) | (static_cast<uint64_t>(m_en_passant_colllumn.value()) << 6); }
+  packed.header |= static_cast<uint64_t>(m_halfmove_clock) << 16;
+  packed.header |= static_cast<uint64_t>(m_fullmove_number) << 32;
+  //whole chunks, so a game at rest holds less than a chunk more than its keys and a quiet move only reallocates once every chunk
+  //a take or a pawn move empties the history, the memory of the longer one is given back then
+  const size_t needed = (m_history.size() + history_chunk - 1) / history_chunk * history_chunk;
+  if (history.capacity() != needed) {
+    std::vector<uint64_t> resized;
+    resized.reserve(needed);
+    history.swap(resized);
+  }
+  history.assign(m_history.begin(), m_history.end());
+  expanded_history = std::move(m_history);
+  return packed;
+}
+bool board::load_fen(std::string_view fen) {
+  static const std::string_view piece_letters = "rnbkqp";
+  std::array<uint8_t, 64> squares;
+  squares.fill(no_piece);
+  size_t i = 0;
+  auto next_field = [&]() {
+    while (i < fen.size() && fen[i] == ' ') { i += 1; }
+    const size_t start = i;
+    while (i < fen.size() && fen[i] != ' ') { i += 1; }
+    return fen.substr(start, i - start);
+  };
+  auto parse_number = [](std::string_view field, uint16_t &value) {
+    if (field.empty() || field.size() > 5) { return false; }
+    uint32_t retval = 0;
+    for (char c : field) {
+      if (c < '0' || c > '9') { return false; }
+      retval = retval * 10 + (c - '0');
+    }
+    if (retval > UINT16_MAX) { return false; }
+    value = static_cast<uint16_t>(retval);
+    return true;
+  };
+
+  //piece placement, from the last row down to the first one
+  const std::string_view placement = next_field();
+  uint8_t x = 7, y = 0;
+  bool after_digit = false;
+  for (char c : placement) {
+    if (c == '/') {
+      if (y != 8 || x == 0) { return false; }
+      x -= 1;
+      y = 0;
+      after_digit = false;
+    } else if (c >= '1' && c <= '8') {
+      //a run of empty squares is always written as one digit
+      if (after_digit) { return false; }
+      y += c - '0';
+      if (y > 8) { return false; }
+      after_digit = true;
+    } else {
+      after_digit = false;
+      const size_t type = piece_letters.find(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+      if (type == std::string_view::npos || y >= 8) { return false; }
+      //pawns can never stand on the first or last row
+      if (type == pawn && (x == 0 || x == 7)) { return false; }
+      squares[x * 8 + y] = piece_index(c >= 'A' && c <= 'Z' ? color::white : color::black, static_cast<piece_type>(type));
+      y += 1;
+    }
+  }
+  if (x != 0 || y != 8) { return false; }
+
+  const std::string_view side_to_move = next_field();
+  if (side_to_move != "w" && side_to_move != "b") { return false; }
+  const color turn = side_to_move == "w" ? color::white : color::black;
+
+  std::array<std::array<bool, 2>, 2> can_castle = { std::array<bool, 2>( { false, false } ), std::array<bool, 2>( { false, false } ) };
+  const std::string_view castling = next_field();
+  if (castling.empty()) { return false; }
+  if (castling != "-") {
+    for (char c : castling) {
+      switch (c) {
+        case 'K': can_castle[0][1] = true; break;
+        case 'Q': can_castle[0][0] = true; break;
+        case 'k': can_castle[1][1] = true; break;
+        case 'q': can_castle[1][0] = true; break;
+        default: return false;
+      }
+    }
+  }
+  //castling rights are only kept while the king and the rook are still on their starting squares
+  for (size_t c = 0; c < 2; c += 1) {
+    for (size_t side = 0; side < 2; side += 1) {
+      const uint8_t row = c ? 56 : 0;
+      if (can_castle[c][side] && (squares[row + 4] != piece_index(static_cast<color>(c), king) || squares[row + (side ? 7 : 0)] != piece_index(static_cast<color>(c), rook))) {
+        return false;
+      }
+    }
+  }
+
+  std::optional<uint8_t> en_passant_colllumn;
+  const std::string_view en_passant_square = next_field();
+  if (en_passant_square != "-") {
+    //the square behind a pawn of the side not to move that just made a two step move
+    if (en_passant_square.size() != 2 || en_passant_square[0] < 'a' || en_passant_square[0] > 'h' || en_passant_square[1] != (turn == color::white ? '6' : '3')) {
+      return false;
+    }
+    const uint8_t collumn = static_cast<uint8_t>(en_passant_square[0] - 'a');
+    const uint8_t pawn_square = turn == color::white ? 32 + collumn : 24 + collumn;
+    if (squares[pawn_square] != piece_index(opposite(turn), pawn)) { return false; }
+    //the pawn just went over the square and came from the one behind it, both are still empty
+    const uint8_t skipped_square = turn == color::white ? 40 + collumn : 16 + collumn;
+    const uint8_t origin_square = turn == color::white ? 48 + collumn : 8 + collumn;
+    if (squares[skipped_square] != no_piece || squares[origin_square] != no_piece) { return false; }
+    en_passant_colllumn = collumn;
+  }
+
+  uint16_t halfmove_clock = 0, fullmove_number = 1;
+  const std::string_view halfmove_field = next_field();
+  const std::string_view fullmove_field = next_field();
+  if ((!halfmove_field.empty() && !parse_number(halfmove_field, halfmove_clock)) || (!fullmove_field.empty() && !parse_number(fullmove_field, fullmove_number))) {
+    return false;
+  }
+  if (!next_field().empty()) { return false; }
+
+  //everything parsed, now check that the position can be played
+  std::array<uint8_t, 2> king_count = { 0, 0 };
+  std::array<coords, 2> king_coords;
+  for (uint8_t square = 0; square < 64; square += 1) {
+    if (squares[square] != no_piece && squares[square] % 6 == king) {
+      king_count[squares[square] / 6] += 1;
+      king_coords[squares[square] / 6] = to_coords(square);
+    }
+  }
+  if (king_count[0] != 1 || king_count[1] != 1) { return false; }
+
+  //every piece past a side's starting set has to be a promoted pawn, and the packed form only has room for 32 pieces
+  for (size_t c = 0; c < 2; c += 1) {
+    std::array<uint8_t, 6> count = {};
+    std::array<uint8_t, 2> bishops_by_square_colour = { 0, 0 };
+    uint8_t total = 0;
+    for (uint8_t square = 0; square < 64; square += 1) {
+      if (squares[square] == no_piece || squares[square] / 6 != c) { continue; }
+      count[squares[square] % 6] += 1;
+      total += 1;
+      if (squares[square] % 6 == bishop) { bishops_by_square_colour[(square / 8 + square % 8) % 2] += 1; }
+    }
+    auto extra = [](uint8_t present, uint8_t at_start) { return present > at_start ? present - at_start : 0; };
+    const int promoted = extra(count[queen], 1) + extra(count[rook], 2) + extra(count[knight], 2) + extra(bishops_by_square_colour[0], 1) + extra(bishops_by_square_colour[1], 1);
+    if (total > 16 || count[pawn] > 8 || promoted > 8 - count[pawn]) { return false; }
+  }
+
+  //the pieces are put in place before the last check, so they are kept aside in case it fails
+  const std::array<bitboard, 12> old_pieces = m_pieces;
+  const std::array<bitboard, 2> old_occupancy = m_occupancy;
+  const std::array<uint8_t, 64> old_squares = m_squares;
+  const std::array<coords, 2> old_king_coords = m_king_coords;
+  const uint64_t old_hash = m_hash;
+  m_pieces.fill(0);
+  m_occupancy.fill(0);
+  m_squares.fill(no_piece);
+  for (uint8_t square = 0; square < 64; square += 1) {
+    if (squares[square] != no_piece) { put_piece(square, squares[square]); }
+  }
+  m_king_coords = king_coords;
+  if (is_in_check(opposite(turn))) {
+    m_pieces = old_pieces;
+    m_occupancy = old_occupancy;
+    m_squares = old_squares;
+    m_king_coords = old_king_coords;
+    m_hash = old_hash;
+    return false;
+  }
+
+  m_turn = turn;
+  m_en_passant_colllumn = en_passant_colllumn;
+  m_can_castle = can_castle;
+  m_halfmove_clock = halfmove_clock;
+  m_fullmove_number = fullmove_number == 0 ? 1 : fullmove_number;
+  m_hash = compute_hash();
+  //earlier positions are unknown, so repetitions are only counted from here on
+  m_history.clear();
+  m_history.reserve(max_history);
+  m_history.push_back(m_hash);
+  return true;
+}
+std::string board::to_fen() const {
+  static const std::string_view piece_letters = "rnbkqpRNBKQP";
+  std::string retval;
+  retval.reserve(92);
+  for (int x = 7; x >= 0; x -= 1) {
+    char empty = '0';
+    for (uint8_t y = 0; y < 8; y += 1) {
+      const uint8_t index = m_squares[x * 8 + y];
+      if (index == no_piece) {
+        empty += 1;
+        continue;
+      }
+      if (empty != '0') { retval.push_back(empty); empty = '0'; }
+      //white pieces are upper case, piece_index puts them first
+      retval.push_back(piece_letters[index < 6 ? index + 6 : index - 6]);
+    }
+    if (empty != '0') { retval.push_back(empty); }
+    if (x != 0) { retval.push_back('/'); }
+  }
+  retval.push_back(' ');
+  retval.push_back(m_turn == color::white ? 'w' : 'b');
+  retval.push_back(' ');
+  const size_t castling_start = retval.size();
+  if (m_can_castle[0][1]) { retval.push_back('K'); }
+  if (m_can_castle[0][0]) { retval.push_back('Q'); }
+  if (m_can_castle[1][1]) { retval.push_back('k'); }
+  if (m_can_castle[1][0]) { retval.push_back('q'); }
+  if (retval.size() == castling_start) { retval.push_back('-'); }
+  retval.push_back(' ');
+  if (m_en_passant_colllumn) {
+    retval.push_back(static_cast<char>('a' + m_en_passant_colllumn.value()));
+    retval.push_back(m_turn == color::white ? '6' : '3');
+  } else {
+    retval.push_back('-');
+  }
+  retval.push_back(' ');
+  retval.append(std::to_string(m_halfmove_clock));
+  retval.push_back(' ');
+  retval.append(std::to_string(m_fullmove_number));
+  return retval;
 }
-board::board() : m_tiles( { std::array<std::optional<piece>, 8>( {  wp(rook) , wp(knight), wp(bishop), wp(queen) ,  wp(king) , wp(bishop), wp(knight),  wp(rook)  } ),
-                            std::array<std::optional<piece>, 8>( {  wp(pawn) ,  wp(pawn) ,  wp(pawn) ,  wp(pawn) ,  wp(pawn) ,  wp(pawn) ,  wp(pawn) ,  wp(pawn)  } ),
-                            std::array<std::optional<piece>, 8>( {   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()   } ),
-                            std::array<std::optional<piece>, 8>( {   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()   } ),
-                            std::array<std::optional<piece>, 8>( {   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()   } ),
-                            std::array<std::optional<piece>, 8>( {   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()  ,   none()   } ),
-                            std::array<std::optional<piece>, 8>( {  bp(pawn) ,  bp(pawn) ,  bp(pawn) ,  bp(pawn) ,  bp(pawn) ,  bp(pawn) ,  bp(pawn) ,  bp(pawn)  } ),
-                            std::array<std::optional<piece>, 8>( {  bp(rook) , bp(knight), bp(bishop), bp(queen) ,  bp(king) , bp(bishop), bp(knight),  bp(rook)  } ), } ),
-                            m_turn(color::white), m_en_passant_colllumn({}), m_can_castle( {  std::array<bool, 2>( { true, true } ), std::array<bool, 2>( { true, true } ) } ), m_king_coords( { coords(0, 4), coords(7, 4) } ) {}
 message board::check_move(coords src, coords dest, promotion p) {
-  switch_turn();
-  return message::confirmation;
+  //src and dest should be within bounds (0..8 or 0..=7)
+  if (!is_in_bounds(src) || !is_in_bounds(dest) || p > promotion::queen) {
+    return message::rejection;
+  }
+  const std::optional<packed_move> m = pseudo_legal_move(to_square(src), to_square(dest), p);
+  if (!m || king_would_be_in_check(m.value(), get_legality_info())) {
+    return message::rejection;
+  }
+  undo_record undo;
+  make_move(m.value(), undo);
+  const bool threefold_repetition = record_position();
+  if (!has_legal_move()) {
+    //checkmate or stalemate
+    return is_in_check(m_turn) ? message::won : message::draw;
+  }
+  return (threefold_repetition || m_halfmove_clock >= seventy_five_move_plies) ? message::draw : message::confirmation;
 }
 color board::turn() {
   return m_turn;
 }
-std::vector<std::pair<coords, move_type>> board::get_potential_moves_for(coords source) const {
-  std::vector<std::pair<coords, move_type>> moves;
-  const std::optional<piece> &sp_opt = m_tiles[source.x][source.y];
-  //source should have a piece and that piece should be of the turning player's colour
-  if (!sp_opt || (sp_opt && sp_opt.value().colour != m_turn)) {
-    return moves;
+uint64_t board::hash() const {
+  return m_hash;
+}
+uint8_t board::piece_index(color colour, piece_type type) {
+  return static_cast<uint8_t>(static_cast<bool>(colour) * 6 + type);
+}
+std::optional<packed_move> board::pseudo_legal_move(uint8_t from, uint8_t to, promotion p) const {
+  const uint8_t index = m_squares[from];
+  const color us = m_turn;
+  const color them = opposite(us);
+  //source should have a piece of the turning player's colour and the destination shouldn't have one
+  if (index == no_piece || static_cast<color>(index / 6) != us || (m_occupancy[static_cast<bool>(us)] & square_bb(to))) {
+    return {};
   }
-  //src and dest should be within bounds (0..8 or 0..=7)
-  if (!is_in_bounds(source)) {
-    return moves;
+  const bitboard occupancy = m_occupancy[0] | m_occupancy[1];
+  const bitboard target = square_bb(to);
+  const piece_type type = static_cast<piece_type>(index % 6);
+  //a promotion has to be sent exactly when a pawn reaches the last row
+  const bool promotes = type == pawn && (to / 8 == 0 || to / 8 == 7);
+  if (promotes != (p != promotion::none)) {
+    return {};
   }
-  const piece &sp = sp_opt.value();
 
-  switch (sp.type) {
+  switch (type) {
     case piece_type::pawn: {
-      bool is_in_starting_row;
-      bool is_in_en_passant_row;
-      bool is_in_second_to_last_row;
-      bool is_in_last_row;
-      coords one_step_forward;
-      coords two_steps_forward;
-      std::array<coords, 2> takes;
-      uint8_t takes_size = 0;
-      switch (sp.colour) {
-        case color::white: {
-          is_in_starting_row = source.x == 1;
-          is_in_en_passant_row = source.x == 4;
-          is_in_second_to_last_row = source.x == 6;
-          is_in_last_row = source.x == 7;
-          one_step_forward = source.altered_with(1, 0);
-          two_steps_forward = source.altered_with(2, 0);
-          for (coords take : { source.altered_with(1, 1), source.altered_with(1, -1) }) {
-            if (is_in_bounds(take)) {
-              takes[takes_size] = take;
-              takes_size += 1;
-            }
-          }
-        } break;
-        case color::black: {
-          is_in_starting_row = source.x == 6;
-          is_in_en_passant_row = source.x == 3;
-          is_in_second_to_last_row = source.x == 1;
-          is_in_last_row = source.x == 0;
-          one_step_forward = source.altered_with(-1, 0);
-          two_steps_forward = source.altered_with(-2, 0);
-          for (coords take : { source.altered_with(-1, 1), source.altered_with(-1, -1) }) {
-            if (is_in_bounds(take)) {
-              takes[takes_size] = take;
-              takes_size += 1;
-            }
-          }
-        } break;
-      }
-      // add move 1 tile and move 2 tiles form the starting position of a pawn
-      if (is_in_starting_row && no_piece_in(one_step_forward)) {
-        add_move(m_tiles, moves, one_step_forward, move_type(move));
-        if (no_piece_in(two_steps_forward)) { add_move(m_tiles, moves, two_steps_forward, move_type(source.y)); }
-      }
-      // add move 1 tile to promotion
-      if (is_in_second_to_last_row && no_piece_in(one_step_forward)) {
-        add_move(m_tiles, moves, one_step_forward, move_type(promote));
-      }
-      // add move 1 tile
-      if (!is_in_starting_row && !is_in_second_to_last_row && !is_in_last_row && no_piece_in(one_step_forward)) {
-        add_move(m_tiles, moves, one_step_forward, move_type(move));
-      }
-      // add en passant
-      if (is_in_en_passant_row && m_en_passant_colllumn) {
-        std::optional<coords> en_passant_coords = {};
-        coords captured_piece;
-        if (m_en_passant_colllumn.value() == source.y - 1) {
-          en_passant_coords = one_step_forward.altered_with(0, -1);
-          captured_piece = source.altered_with(0, -1);
-        } else if (m_en_passant_colllumn.value() == source.y + 1) {
-          en_passant_coords = one_step_forward.altered_with(0, 1);
-          captured_piece = source.altered_with(0, 1);
+      const bool is_white = us == color::white;
+      const uint8_t one_step_forward = is_white ? from + 8 : from - 8;
+      const move_flag flag = promotes ? static_cast<move_flag>(promote_to_knight + static_cast<uint8_t>(p) - 1) : quiet;
+      if (attacks::pawn(us, from) & target) {
+        if (m_occupancy[static_cast<bool>(them)] & target) {
+          return packed_move(from, to, flag);
         }
-        if (en_passant_coords) {
-          add_move(m_tiles, moves, en_passant_coords.value(), move_type(en_passant, captured_piece));
+        //en passant lands behind the pawn that just made a two step move
+        if (m_en_passant_colllumn && to % 8 == m_en_passant_colllumn.value() && from / 8 == (is_white ? 4 : 3)) {
+          return packed_move(from, to, en_passant);
+        }
+        return {};
+      }
+      if (occupancy & square_bb(one_step_forward)) {
+        return {};
+      }
+      if (to == one_step_forward) {
+        return packed_move(from, to, flag);
+      }
+      if (from / 8 == (is_white ? 1 : 6) && to == (is_white ? from + 16 : from - 16) && !(occupancy & target)) {
+        return packed_move(from, to, pawn_two_step);
+      }
+      return {};
+    }
+    case piece_type::rook: {
+      if (attacks::rook(from, occupancy) & target) { return packed_move(from, to, quiet); }
+      return {};
+    }
+    case piece_type::knight: {
+      if (attacks::knight(from) & target) { return packed_move(from, to, quiet); }
+      return {};
+    }
+    case piece_type::bishop: {
+      if (attacks::bishop(from, occupancy) & target) { return packed_move(from, to, quiet); }
+      return {};
+    }
+    case piece_type::queen: {
+      if (attacks::queen(from, occupancy) & target) { return packed_move(from, to, quiet); }
+      return {};
+    }
+    case piece_type::king: {
+      if (attacks::king(from) & target) { return packed_move(from, to, quiet); }
+      //castling is the king moving two squares along its row, the rights imply the king and rook are in place
+      if (from / 8 != to / 8 || (to != from + 2 && to != from - 2)) {
+        return {};
+      }
+      const bool king_side = to > from;
+      const bitboard path = (king_side ? bitboard(0x60) : bitboard(0x0E)) << ((from / 8) * 8);
+      if (!m_can_castle[static_cast<bool>(us)][king_side] || (occupancy & path)
+          || attackers_of(from, them, occupancy) || attackers_of(king_side ? from + 1 : from - 1, them, occupancy)) {
+        return {};
+      }
+      return packed_move(from, to, castle);
+    }
+  }
+  return {};
+}
+void board::get_potential_moves_for(uint8_t from, move_list &moves) const {
+  const uint8_t index = m_squares[from];
+  //source should have a piece and that piece should be of the turning player's colour
+  if (index == no_piece || static_cast<color>(index / 6) != m_turn) {
+    return;
+  }
+  const color us = m_turn;
+  const color them = opposite(us);
+  const bitboard own = m_occupancy[static_cast<bool>(us)];
+  const bitboard occupancy = m_occupancy[0] | m_occupancy[1];
+
+  switch (static_cast<piece_type>(index % 6)) {
+    case piece_type::pawn: {
+      const bool is_white = us == color::white;
+      const uint8_t row = from / 8;
+      //pawns never stand on the last row, so one step forward is always in bounds
+      const uint8_t one_step_forward = is_white ? from + 8 : from - 8;
+      // add move 1 tile (to promotion from the second to last row) and move 2 tiles from the starting position of a pawn
+      if (!(occupancy & square_bb(one_step_forward))) {
+        add_pawn_move(moves, from, one_step_forward);
+        const uint8_t two_steps_forward = is_white ? from + 16 : from - 16;
+        if (row == (is_white ? 1 : 6) && !(occupancy & square_bb(two_steps_forward))) {
+          moves.push_back(packed_move(from, two_steps_forward, pawn_two_step));
         }
       }
       // add take
-      for (uint8_t i = 0; i < takes_size; i += 1) {
-        const std::optional<piece> &to_take = m_tiles[takes[i].x][takes[i].y];
-        if (to_take && to_take.value().colour != sp.colour) {
-          if (is_in_second_to_last_row) {
-            add_move(m_tiles, moves, takes[i], move_type(take_and_promote));
-          }
-          add_move(m_tiles, moves, takes[i], move_type(take));
+      bitboard takes = attacks::pawn(us, from) & m_occupancy[static_cast<bool>(them)];
+      while (takes) {
+        add_pawn_move(moves, from, pop_lsb(takes));
+      }
+      // add en passant
+      if (row == (is_white ? 4 : 3) && m_en_passant_colllumn) {
+        const uint8_t en_passant_square = to_square(coords(one_step_forward / 8, m_en_passant_colllumn.value()));
+        if (attacks::pawn(us, from) & square_bb(en_passant_square)) {
+          moves.push_back(packed_move(from, en_passant_square, en_passant));
         }
       }
     } break;
     case piece_type::rook: {
-      for (coords p : rook_permutations) {
-        add_move_with_takes_by_step(m_tiles, moves, source, p, sp.colour);
-      }
+      add_moves(moves, from, attacks::rook(from, occupancy) & ~own);
     } break;
     case piece_type::knight: {
-      for (coords p : knight_permutations) {
-        coords pos = source.altered_with(p);
-        if (is_in_bounds(pos)) { add_move_with_takes(m_tiles, moves, pos, sp.colour); }
-      }
+      add_moves(moves, from, attacks::knight(from) & ~own);
     } break;
     case piece_type::bishop: {
-      for (coords p : bishop_permutations) {
-        add_move_with_takes_by_step(m_tiles, moves, source, p, sp.colour);
-      }
+      add_moves(moves, from, attacks::bishop(from, occupancy) & ~own);
     } break;
     case piece_type::king: {
-      for (coords p : queen_permutations) {
-        coords pos = source.altered_with(p);
-        if (is_in_bounds(pos)) { add_move_with_takes(m_tiles, moves, pos, sp.colour); }
+      add_moves(moves, from, attacks::king(from) & ~own);
+      //the landing square is checked like any other king move, the rest is checked here
+      const std::array<bool, 2> &can_castle = m_can_castle[static_cast<bool>(us)];
+      if (!(can_castle[0] || can_castle[1]) || attackers_of(from, them, occupancy)) {
+        break;
       }
-      if (m_can_castle[static_cast<bool>(m_turn)][0]) {
-        //
+      const uint8_t row_shift = (from / 8) * 8;
+      if (can_castle[0] && !(occupancy & (bitboard(0x0E) << row_shift)) && !attackers_of(from - 1, them, occupancy)) {
+        moves.push_back(packed_move(from, from - 2, castle));
       }
-      if (m_can_castle[static_cast<bool>(m_turn)][1]) {
-        //
+      if (can_castle[1] && !(occupancy & (bitboard(0x60) << row_shift)) && !attackers_of(from + 1, them, occupancy)) {
+        moves.push_back(packed_move(from, from + 2, castle));
       }
     } break;
     case piece_type::queen: {
-      for (coords p : queen_permutations) {
-        add_move_with_takes_by_step(m_tiles, moves, source, p, sp.colour);
-      }
+      add_moves(moves, from, attacks::queen(from, occupancy) & ~own);
     } break;
   }
-  return moves;
 }
-void board::add_move(const std::array<std::array<std::optional<piece>, 8>, 8> &tiles, std::vector<std::pair<coords, move_type>> &potential_moves, coords coords, move_type move_type) {
-  
+void board::add_moves(move_list &moves, uint8_t from, bitboard targets) {
+  while (targets) {
+    moves.push_back(packed_move(from, pop_lsb(targets), quiet));
+  }
 }
-void board::add_move_with_takes(const std::array<std::array<std::optional<piece>, 8>, 8> &tiles, std::vector<std::pair<coords, move_type>> &potential_moves, coords coords, color colour) {
-  if (tiles[coords.x][coords.y]) {
-    if (tiles[coords.x][coords.y].value().colour != colour) {
-      add_move(tiles, potential_moves, coords, take);
-    }
+void board::add_pawn_move(move_list &moves, uint8_t from, uint8_t to) {
+  const uint8_t row = to / 8;
+  if (row != 0 && row != 7) {
+    moves.push_back(packed_move(from, to, quiet));
     return;
   }
-  add_move(tiles, potential_moves, coords, move);
+  for (move_flag flag : { promote_to_knight, promote_to_bishop, promote_to_rook, promote_to_queen }) {
+    moves.push_back(packed_move(from, to, flag));
+  }
+}
+void board::make_move(packed_move m, undo_record &undo) {
+  const color us = m_turn;
+  const uint8_t from = m.from();
+  const uint8_t to = m.to();
+  const piece_type moving = static_cast<piece_type>(m_squares[from] % 6);
+  undo.captured = m_squares[to];
+  undo.en_passant_colllumn = m_en_passant_colllumn;
+  undo.can_castle = m_can_castle;
+  undo.king_coords = m_king_coords;
+  undo.hash = m_hash;
+  undo.halfmove_clock = m_halfmove_clock;
+
+  if (m_en_passant_colllumn) { m_hash ^= zobrist.en_passant[m_en_passant_colllumn.value()]; }
+  m_hash ^= castling_hash(m_can_castle);
+  m_en_passant_colllumn.reset();
+  m_halfmove_clock = (undo.captured != no_piece || moving == pawn) ? 0 : m_halfmove_clock + 1;
+  if (us == color::black) { m_fullmove_number += 1; }
+  if (undo.captured != no_piece) {
+    remove_piece(to);
+  }
+  switch (m.flag()) {
+    case en_passant: {
+      //the taken pawn is beside the source square, on the destination's collumn
+      const uint8_t taken = to_square(coords(from / 8, to % 8));
+      undo.captured = m_squares[taken];
+      remove_piece(taken);
+    } break;
+    case castle: {
+      const bool king_side = to > from;
+      remove_piece(king_side ? from + 3 : from - 4);
+      put_piece(king_side ? from + 1 : from - 1, piece_index(us, rook));
+    } break;
+    case pawn_two_step: {
+      m_en_passant_colllumn = from % 8;
+      m_hash ^= zobrist.en_passant[from % 8];
+    } break;
+    default: break;
+  }
+  remove_piece(from);
+  put_piece(to, piece_index(us, m.is_promotion() ? promoted_to(m.promotes_to()) : moving));
+
+  if (moving == king) {
+    m_king_coords[static_cast<bool>(us)] = to_coords(to);
+    m_can_castle[static_cast<bool>(us)] = { false, false };
+  }
+  //a rook that leaves its corner or gets taken there can't be castled with anymore
+  for (size_t c = 0; c < 2; c += 1) {
+    for (size_t side = 0; side < 2; side += 1) {
+      const bitboard corner = square_bb(to_square(coords(c ? 7 : 0, side ? 7 : 0)));
+      if (corner & (square_bb(from) | square_bb(to))) { m_can_castle[c][side] = false; }
+    }
+  }
+  m_hash ^= castling_hash(m_can_castle);
+  switch_turn();
+}
+void board::unmake_move(packed_move m, const undo_record &undo) {
+  switch_turn();
+  const color us = m_turn;
+  const uint8_t from = m.from();
+  const uint8_t to = m.to();
+  const uint8_t moving = m.is_promotion() ? piece_index(us, pawn) : m_squares[to];
+
+  remove_piece(to);
+  put_piece(from, moving);
+  switch (m.flag()) {
+    case en_passant: {
+      put_piece(to_square(coords(from / 8, to % 8)), undo.captured);
+    } break;
+    case castle: {
+      const bool king_side = to > from;
+      remove_piece(king_side ? from + 1 : from - 1);
+      put_piece(king_side ? from + 3 : from - 4, piece_index(us, rook));
+    } break;
+    default: {
+      if (undo.captured != no_piece) {
+        put_piece(to, undo.captured);
+      }
+    } break;
+  }
+
+  m_en_passant_colllumn = undo.en_passant_colllumn;
+  m_can_castle = undo.can_castle;
+  m_king_coords = undo.king_coords;
+  m_hash = undo.hash;
+  m_halfmove_clock = undo.halfmove_clock;
+  if (us == color::black) { m_fullmove_number -= 1; }
 }
 bool board::is_in_bounds(coords c) {
   return c.x < 8 && c.y < 8;
 }
-bool board::no_piece_in(coords c) const {
-  return !m_tiles[c.x][c.y];
+std::optional<piece> board::piece_on(coords c) const {
+  uint8_t index = m_squares[to_square(c)];
+  if (index == no_piece) {
+    return {};
+  }
+  return piece { static_cast<piece_type>(index % 6), static_cast<color>(index / 6) };
+}
+bitboard board::pieces(color colour, piece_type type) const {
+  return m_pieces[piece_index(colour, type)];
 }
-void board::add_move_with_takes_by_step(const std::array<std::array<std::optional<piece>, 8>, 8> &tiles, std::vector<std::pair<coords, move_type>> &potential_moves, coords c, coords step, color colour) {
-  while (is_in_bounds(c)) {
-    if (tiles[c.x][c.y]) {
-      if (tiles[c.x][c.y].value().colour != colour) {
-        add_move(tiles, potential_moves, c, take);
-      }
-      return;
+bitboard board::attackers_of(uint8_t square, color colour, bitboard occupancy) const {
+  return (attacks::knight(square) & pieces(colour, knight))
+       | (attacks::king(square) & pieces(colour, king))
+       | (attacks::pawn(opposite(colour), square) & pieces(colour, pawn))
+       | (attacks::rook(square, occupancy) & (pieces(colour, rook) | pieces(colour, queen)))
+       | (attacks::bishop(square, occupancy) & (pieces(colour, bishop) | pieces(colour, queen)));
+}
+bool board::is_in_check(color colour) const {
+  return attackers_of(to_square(m_king_coords[static_cast<bool>(colour)]), opposite(colour), m_occupancy[0] | m_occupancy[1]) != 0;
+}
+board::legality_info board::get_legality_info() const {
+  const color us = m_turn;
+  const color them = opposite(us);
+  const uint8_t king_square = to_square(m_king_coords[static_cast<bool>(us)]);
+  const bitboard occupancy = m_occupancy[0] | m_occupancy[1];
+  legality_info info;
+
+  info.checkers = attackers_of(king_square, them, occupancy);
+  info.pinned = 0;
+  //sliders that would see the king on an empty board, exactly one own piece in between means a pin
+  bitboard snipers = (attacks::rook(king_square, 0) & (pieces(them, rook) | pieces(them, queen)))
+                   | (attacks::bishop(king_square, 0) & (pieces(them, bishop) | pieces(them, queen)));
+  while (snipers) {
+    const bitboard blockers = attacks::between(king_square, pop_lsb(snipers)) & occupancy;
+    if (popcount(blockers) == 1) { info.pinned |= blockers & m_occupancy[static_cast<bool>(us)]; }
+  }
+  switch (popcount(info.checkers)) {
+    case 0: info.check_mask = ~bitboard(0); break;
+    case 1: info.check_mask = info.checkers | attacks::between(king_square, lsb(info.checkers)); break;
+    default: info.check_mask = 0; break;
+  }
+  return info;
+}
+bool board::king_would_be_in_check(packed_move m, const legality_info &info) const {
+  const color them = opposite(m_turn);
+  const uint8_t king_square = to_square(m_king_coords[static_cast<bool>(m_turn)]);
+  const uint8_t from = m.from();
+  const uint8_t to = m.to();
+  const bitboard occupancy = m_occupancy[0] | m_occupancy[1];
+
+  if (from == king_square) {
+    //the king itself can't block a slider's ray to the square it's stepping back to
+    //castling already checked everything except the landing square when generated
+    return attackers_of(to, them, occupancy ^ square_bb(from)) != 0;
+  }
+  if (m.flag() == en_passant) {
+    //two pawns leave the row at once, so just look at the king with the resulting occupancy
+    const bitboard taken = square_bb(to_square(coords(from / 8, to % 8)));
+    const bitboard after = (occupancy ^ square_bb(from) ^ taken) | square_bb(to);
+    return (attackers_of(king_square, them, after) & ~taken) != 0;
+  }
+  if (!(info.check_mask & square_bb(to))) {
+    return true;
+  }
+  //a pinned piece can only move along the line of the pin
+  return (info.pinned & square_bb(from)) && !(attacks::line(king_square, from) & square_bb(to));
+}
+void board::generate_legal_moves(move_list &moves) const {
+  const legality_info info = get_legality_info();
+  bitboard own = m_occupancy[static_cast<bool>(m_turn)];
+  while (own) {
+    move_list pseudo_legal_moves;
+    get_potential_moves_for(pop_lsb(own), pseudo_legal_moves);
+    for (packed_move m : pseudo_legal_moves) {
+      if (!king_would_be_in_check(m, info)) { moves.push_back(m); }
     }
-    add_move(tiles, potential_moves, c, move);
-    c = c.altered_with(step);
   }
 }
-bool board::king_would_be_in_check(coords src, coords dest, promotion p) const {
+bool board::has_legal_move() const {
+  const legality_info info = get_legality_info();
+  bitboard own = m_occupancy[static_cast<bool>(m_turn)];
+  while (own) {
+    move_list moves;
+    get_potential_moves_for(pop_lsb(own), moves);
+    for (packed_move m : moves) {
+      if (!king_would_be_in_check(m, info)) {
+        return true;
+      }
+    }
+  }
   return false;
 }
+bool board::record_position() {
+  if (m_halfmove_clock == 0) {
+    m_history.clear();
+  }
+  //only positions with the same player to move can be the same, those are two plies apart
+  uint8_t seen = 0;
+  for (size_t i = m_history.size(); i >= 2; i -= 2) {
+    if (m_history[i - 2] == m_hash) { seen += 1; }
+  }
+  m_history.push_back(m_hash);
+  return seen >= 2;
+}
+uint64_t board::compute_hash() const {
+  uint64_t retval = castling_hash(m_can_castle);
+  for (uint8_t square = 0; square < 64; square += 1) {
+    if (m_squares[square] != no_piece) { retval ^= zobrist.pieces[m_squares[square]][square]; }
+  }
+  if (m_en_passant_colllumn) { retval ^= zobrist.en_passant[m_en_passant_colllumn.value()]; }
+  if (m_turn == color::black) { retval ^= zobrist.black_to_move; }
+  return retval;
+}
+uint64_t board::castling_hash(const std::array<std::array<bool, 2>, 2> &can_castle) {
+  uint64_t retval = 0;
+  for (size_t c = 0; c < 2; c += 1) {
+    for (size_t side = 0; side < 2; side += 1) {
+      if (can_castle[c][side]) { retval ^= zobrist.can_castle[c][side]; }
+    }
+  }
+  return retval;
+}
+void board::put_piece(uint8_t square, uint8_t index) {
+  m_pieces[index] |= square_bb(square);
+  m_occupancy[index / 6] |= square_bb(square);
+  m_squares[square] = index;
+  m_hash ^= zobrist.pieces[index][square];
+}
+void board::remove_piece(uint8_t square) {
+  const uint8_t index = m_squares[square];
+  m_pieces[index] &= ~square_bb(square);
+  m_occupancy[index / 6] &= ~square_bb(square);
+  m_squares[square] = no_piece;
+  m_hash ^= zobrist.pieces[index][square];
+}
 void board::switch_turn() {
-  m_turn = static_cast<color>(!static_cast<bool>(m_turn));
+  m_turn = opposite(m_turn);
+  m_hash ^= zobrist.black_to_move;
 }
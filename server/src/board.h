@@ -2,11 +2,14 @@
 
 #include "../../common/enums.h"
 #include "../../common/utils.h"
+#include "bitboard.h"
+#include "zobrist.h"
 
 #include <array>
 #include <vector>
+#include <string>
+#include <string_view>
 #include <optional>
-#include <variant>
 
 enum piece_type {
   rook,
@@ -17,60 +20,171 @@ enum piece_type {
   pawn,
 };
 
-enum move_type_enum {
-  move,
-  take,
+enum move_flag : uint8_t {
+  quiet,
+  pawn_two_step,
   castle,
   en_passant,
-  pawn_two_step,
-  promote,
-  take_and_promote,
+  //promotions keep the promoted piece in the two low bits, in the same order as the promotion enum
+  promote_to_knight,
+  promote_to_bishop,
+  promote_to_rook,
+  promote_to_queen,
 };
 
-struct move_type {
-  move_type_enum type;
-  std::optional<std::variant<coords, uint8_t>> influence;
-  //en passant and castle
-  move_type(move_type_enum type, coords influenced_piece) : type(type), influence(influenced_piece) {}
-  //for two step pawn moves
-  move_type(uint8_t influenced_collumn) : type(pawn_two_step), influence(influenced_collumn) {}
-  //anything else
-  move_type(move_type_enum type) : type(type), influence({}) {}
+//from: 6 bits
+//to: 6 bits
+//flag: 4 bits
+//takes are not flagged, the board knows what is on the destination square
+struct packed_move {
+  uint16_t data;
+  packed_move() = default;
+  packed_move(uint8_t from, uint8_t to, move_flag flag) : data(static_cast<uint16_t>(from | to << 6 | flag << 12)) {}
+  uint8_t from() const { return data & 0x3F; }
+  uint8_t to() const { return (data >> 6) & 0x3F; }
+  move_flag flag() const { return static_cast<move_flag>(data >> 12); }
+  bool is_promotion() const { return flag() >= promote_to_knight; }
+  promotion promotes_to() const { return is_promotion() ? static_cast<promotion>(flag() - promote_to_knight + 1) : promotion::none; }
 };
 
-static const std::array<coords, 8> knight_permutations = { coords(-2,  1), coords(-1,  2), coords( 1,  2), coords( 2,  1), coords( 2, -1), coords( 1, -2), coords(-1, -2), coords(-2, -1) };
-static const std::array<coords, 4> rook_permutations   = { coords(-1,  0), coords( 0,  1), coords( 1,  0), coords( 0, -1) };
-static const std::array<coords, 4> bishop_permutations = { coords(-1,  1), coords( 1,  1), coords( 1, -1), coords(-1, -1) };
-static const std::array<coords, 8> queen_permutations  = { coords(-1,  0), coords(-1,  1), coords( 0,  1), coords( 1,  1), coords( 1,  0), coords( 1, -1), coords( 0, -1), coords(-1, -1) };
+//fixed capacity so move generation never touches the heap, no position has more than 218 legal moves
+class move_list {
+public:
+  move_list() : m_size(0) {}
+  void push_back(packed_move m) { m_moves[m_size] = m; m_size += 1; }
+  size_t size() const { return m_size; }
+  const packed_move *begin() const { return m_moves.data(); }
+  const packed_move *end() const { return m_moves.data() + m_size; }
+private:
+  std::array<packed_move, 256> m_moves;
+  size_t m_size;
+};
 
 struct piece {
   piece_type type;
   color colour;
 };
 
+//32 byte form of a board, kept by games while they wait for a move
+//occupancy: 8 bytes
+//pieces: 16 bytes, the piece_index of every occupied square in square order, two per byte, low nibble first
+//  (a board never holds more than 32 pieces)
+//header: 8 bytes
+//  bit 0: turn
+//  bits 1-4: castling rights, in m_can_castle order
+//  bit 5: en passant possible, bits 6-8: en passant collumn
+//  bits 16-31: halfmove clock
+//  bits 32-47: fullmove number
+struct packed_board {
+  bitboard occupancy;
+  std::array<uint8_t, 16> pieces;
+  uint64_t header;
+  color turn() const { return static_cast<color>(header & 1); }
+};
+static_assert(sizeof(packed_board) == 32, "packed_board should stay 32 bytes");
+
 class board {
 public:
+  // everything make_move overwrites that can't be worked out backwards from the move itself
+  struct undo_record {
+    // piece_index of the taken piece (the en passant pawn included), no_piece if nothing was taken
+    uint8_t captured;
+    std::optional<uint8_t> en_passant_colllumn;
+    std::array<std::array<bool, 2>, 2> can_castle;
+    std::array<coords, 2> king_coords;
+    uint64_t hash;
+    uint16_t halfmove_clock;
+  };
+
   board();
+  // expands a packed board with the repetition history kept beside it
+  board(const packed_board &, const std::vector<uint64_t> &);
+  // packs the position and copies the repetition history out, into a buffer only as big as it needs to be
+  packed_board pack(std::vector<uint64_t> &);
+  // replaces the position with the one described by the FEN string
+  // returns false and leaves the board untouched if the string is malformed or the position can't be played
+  // (missing kings, pawns on the last rows, more pieces than promotions could make, castling rights without the pieces in place,
+  // an en passant square the pawn couldn't have just crossed, the side not to move in check)
+  // the move clocks are optional, they default to 0 and 1
+  bool load_fen(std::string_view);
+  std::string to_fen() const;
   message check_move(coords, coords, promotion);
   color turn();
+  // zobrist key of the position, kept up to date by make_move
+  uint64_t hash() const;
+  // every legal move of the turning player
+  void generate_legal_moves(move_list &) const;
+  // plays a pseudo legal move in place, the record has to be passed back to unmake_move
+  void make_move(packed_move, undo_record &);
+  // takes back the last move made with make_move
+  void unmake_move(packed_move, const undo_record &);
 private:
-  std::vector<std::pair<coords, move_type>> get_potential_moves_for(coords) const;
-  static void add_move(const std::array<std::array<std::optional<piece>, 8>, 8> &, std::vector<std::pair<coords, move_type>> &, coords, move_type);
-  static void add_move_with_takes(const std::array<std::array<std::optional<piece>, 8>, 8> &, std::vector<std::pair<coords, move_type>> &, coords, color);
-  static std::array<std::array<std::optional<piece>, 8>, 8> get_move_demo(coords, move_type);
+  // index of a piece in m_pieces and value stored in m_squares
+  static uint8_t piece_index(color, piece_type);
+  static constexpr uint8_t no_piece = 12;
+  // the game is drawn once this many moves went by without a take or a pawn move (fide's 75 move rule)
+  static constexpr uint16_t seventy_five_move_plies = 150;
+  // so the history never has more positions than this, it's reserved up front and a move never grows it
+  static constexpr size_t max_history = seventy_five_move_plies + 1;
+  // packed histories grow by this many keys at a time, a cache line
+  static constexpr size_t history_chunk = 8;
+
+  // checks only the geometry and the blockers for the piece on the source square
+  // gives back the move with the right flag if it's pseudo legal, or nothing otherwise
+  std::optional<packed_move> pseudo_legal_move(uint8_t, uint8_t, promotion) const;
+  // pseudo legal moves of the piece on the passed square, nothing is added if it's not the turning player's
+  void get_potential_moves_for(uint8_t, move_list &) const;
+  // adds every square in targets as a move from the passed square, targets should not contain own pieces
+  static void add_moves(move_list &, uint8_t, bitboard);
+  // adds all four promotions, or a plain move if the pawn doesn't reach the last row
+  static void add_pawn_move(move_list &, uint8_t, uint8_t);
   static bool is_in_bounds(coords);
-  bool no_piece_in(coords) const;
-  static void add_move_with_takes_by_step(const std::array<std::array<std::optional<piece>, 8>, 8> &, std::vector<std::pair<coords, move_type>> &, coords, coords, color);
-  bool king_would_be_in_check(coords, coords, promotion) const;
+  std::optional<piece> piece_on(coords) const;
+  bitboard pieces(color, piece_type) const;
+  // every piece of the passed colour that attacks the square, given the occupancy
+  bitboard attackers_of(uint8_t, color, bitboard) const;
+  bool is_in_check(color) const;
+  // worked out once per position, makes king_would_be_in_check a couple of mask tests for most moves
+  struct legality_info {
+    bitboard checkers;
+    // own pieces that stand between the king and an enemy slider
+    bitboard pinned;
+    // where a non king move has to land: anywhere when not in check,
+    // on the checker or between it and the king in a single check, nowhere in a double check
+    bitboard check_mask;
+  };
+  legality_info get_legality_info() const;
+  // the move has to be pseudo legal, only king moves and en passant look past the masks
+  bool king_would_be_in_check(packed_move, const legality_info &) const;
+  bool has_legal_move() const;
+  // zobrist key of every position since the last take or pawn move, the current one included
+  // works out whether the current position has now been reached for the third time
+  bool record_position();
+  uint64_t compute_hash() const;
+  static uint64_t castling_hash(const std::array<std::array<bool, 2>, 2> &);
+  void put_piece(uint8_t, uint8_t);
+  void remove_piece(uint8_t);
   void switch_turn();
 
-  std::array<std::array<std::optional<piece>, 8>, 8> m_tiles;
+  // one bitboard for every colour and piece type, indexed with piece_index
+  std::array<bitboard, 12> m_pieces;
+  std::array<bitboard, 2> m_occupancy;
+  // what piece_index is on every square, no_piece for empty ones
+  std::array<uint8_t, 64> m_squares;
   color m_turn;
   std::optional<uint8_t> m_en_passant_colllumn;
   //what can_castle means:
   //king has not moved
   //the rook it's trying to castle with hasn't moved
-  //the king is not in check, will not get in check after castling and the skipped swuare is not checked
+  //indexed by colour, then by side (0 is the rook on the first collumn, 1 the one on the last)
+  //the king not being in check, not getting in check after castling and the skipped square not being checked are verified when moving
   std::array<std::array<bool, 2>, 2> m_can_castle;
   std::array<coords, 2> m_king_coords;
+  uint64_t m_hash;
+  // moves since the last take or pawn move
+  uint16_t m_halfmove_clock;
+  // starts at 1, goes up after every black move
+  uint16_t m_fullmove_number;
+  // keys of the positions since the last take or pawn move, only those can ever repeat
+  std::vector<uint64_t> m_history;
 };
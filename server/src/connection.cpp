@@ -0,0 +1,49 @@
+#include "connection.h"
+
+#include "../../common/utils.h"
+
+#include <sys/resource.h>
+
+namespace {
+  // one slot per possible fd, never resized after init_table so any thread can index it
+  // entries are made once per fd and reused by every socket that gets the fd after
+  std::vector<std::atomic<connection *>> table;
+  // the kernel's default cap on the fd limit (fs.nr_open), a limit of RLIM_INFINITY can't be allocated for
+  constexpr rlim_t max_table_size = 1 << 20;
+}
+
+void connection::init_table() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+    error_print("connection getrlimit");
+    limit.rlim_cur = 1024;
+    limit.rlim_max = 1024;
+  }
+  rlim_t size = limit.rlim_cur == RLIM_INFINITY ? limit.rlim_max : limit.rlim_cur;
+  if (size == RLIM_INFINITY || size > max_table_size) { size = max_table_size; }
+  table = std::vector<std::atomic<connection *>>(static_cast<size_t>(size));
+}
+bool connection::fits(int fd) {
+  return fd >= 0 && static_cast<size_t>(fd) < table.size();
+}
+connection &connection::get(int fd) {
+  std::atomic<connection *> &slot = table.at(static_cast<size_t>(fd));
+  connection *retval = slot.load(std::memory_order_acquire);
+  if (retval == nullptr) {
+    retval = new connection();
+    slot.store(retval, std::memory_order_release);
+  }
+  return *retval;
+}
+connection *connection::find(int fd) {
+  if (fd < 0 || static_cast<size_t>(fd) >= table.size()) { return nullptr; }
+  return table[static_cast<size_t>(fd)].load(std::memory_order_acquire);
+}
+std::vector<int> connection::owned_by(const big_poll *owner) {
+  std::vector<int> retval;
+  for (size_t fd = 0; fd < table.size(); fd += 1) {
+    connection *c = table[fd].load(std::memory_order_acquire);
+    if (c != nullptr && c->owner.load() == owner) { retval.push_back(static_cast<int>(fd)); }
+  }
+  return retval;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "frame_reader.h"
+#include "timing_wheel.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+class big_poll;
+class game;
+
+// everything the server keeps about one client socket, indexed by fd
+// a socket is registered with the big_poll reactor that accepted it and stays there until it's closed,
+// going to the queue or into a game and back only changes its state
+struct connection {
+  enum class state : uint8_t {
+    lobby,
+    queued,
+    // asked the queue to take it out, the frame that made it ask waits for the answer (or for the game it was paired into)
+    leaving_queue,
+    in_game,
+  };
+
+  // sizes the table to the process' fd limit (capped, the limit can be unlimited), has to be called once before any reactor starts
+  static void init_table();
+  // false for fds past the end of the table, those can't be registered
+  static bool fits(int);
+  // the fd's entry, made the first time the fd is accepted, only called by the reactor that accepted it
+  static connection &get(int);
+  // nullptr if the fd was never accepted, can be called from any thread
+  static connection *find(int);
+  // the fds of every socket living in the reactor, walks the whole table so it's only meant for shutting down
+  static std::vector<int> owned_by(const big_poll *);
+
+  // the only fields other threads read, to route what they have for the socket to its reactor
+  // the generation is bumped every time the fd is closed, so anything meant for an older socket with the same fd is dropped
+  std::atomic<big_poll *> owner = nullptr;
+  std::atomic<uint32_t> generation = 0;
+
+  // everything else is only touched by the owner
+  state current = state::lobby;
+  frame_reader input;
+  // shared with the opponent's connection, which can be in another reactor
+  std::shared_ptr<game> current_game;
+  // when the socket last sent anything or changed state, the idle timer is checked against it
+  timing_wheel::clock::time_point last_active;
+  // in the reactor's timing wheel, the idle timer while the socket is in the lobby or the queue, the clock timer while it's in a game
+  timing_wheel::timer idle_timer;
+  timing_wheel::timer clock_timer;
+};
@@ -0,0 +1,148 @@
+#include "epoll_backend.h"
+
+#include "../../common/utils.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+std::unique_ptr<io_backend> epoll_backend::create() {
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd == -1) {
+    error_print("epoll_backend epoll_create");
+    return nullptr;
+  }
+  return std::unique_ptr<io_backend>(new epoll_backend(epoll_fd));
+}
+epoll_backend::epoll_backend(int epoll_fd) : m_epoll_fd(epoll_fd) {}
+epoll_backend::~epoll_backend() {
+  if (::close(m_epoll_fd) == -1) { error_print("epoll_backend close"); }
+}
+const char *epoll_backend::name() const {
+  return "epoll";
+}
+bool epoll_backend::add_with(int fd, uint32_t events) {
+  epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  return epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != -1;
+}
+bool epoll_backend::add_listener(int fd) {
+  return add_with(fd, EPOLLIN);
+}
+bool epoll_backend::add_wakeup(int fd) {
+  return add_with(fd, EPOLLIN);
+}
+bool epoll_backend::add(int fd) {
+  if (add_with(fd, EPOLLIN | EPOLLET) == false) { return false; }
+  socket_output &o = output(fd);
+  o.watched = true;
+  o.waiting_for_out = false;
+  o.error = 0;
+  return true;
+}
+epoll_backend::socket_output &epoll_backend::output(int fd) {
+  size_t idx = static_cast<size_t>(fd);
+  if (idx >= m_output.size()) {
+    m_output.resize(std::max(idx + 1, m_output.size() * 2));
+  }
+  return m_output[idx];
+}
+void epoll_backend::queue_output(int fd) {
+  socket_output &o = output(fd);
+  if (o.queued) { return; }
+  o.queued = true;
+  m_pending_output.push_back(fd);
+}
+void epoll_backend::flush(int fd) {
+  socket_output &o = output(fd);
+  if (o.watched == false || o.error != 0) { return; }
+  if (o.queue.flush(fd) == false) {
+    o.error = errno;
+    o.queue.clear();
+    m_failed.push_back(fd);
+  }
+  bool want_out = o.error == 0 && o.queue.empty() == false;
+  if (want_out == o.waiting_for_out) { return; }
+  epoll_event ev;
+  ev.events = want_out ? EPOLLIN | EPOLLOUT | EPOLLET : EPOLLIN | EPOLLET;
+  ev.data.fd = fd;
+  if (epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) { error_print("epoll_backend epoll_ctl modify"); }
+  o.waiting_for_out = want_out;
+}
+void epoll_backend::flush_output() {
+  std::vector<int> pending;
+  std::swap(pending, m_pending_output);
+  for (int fd : pending) {
+    output(fd).queued = false;
+    flush(fd);
+  }
+}
+int epoll_backend::wait(std::vector<epoll_event> &events) {
+  int nfds;
+  //writability alone isn't an event for the reactor, so this can take a few rounds
+  do {
+    flush_output();
+    //don't block if there are sockets to report already
+    int timeout = m_failed.empty() ? -1 : 0;
+    while ((nfds = epoll_wait(m_epoll_fd, events.data(), static_cast<int>(events.size()), timeout)) == -1 && errno == EINTR) {}
+    if (nfds == -1) { return -1; }
+
+    int kept = 0;
+    for (int i = 0; i < nfds; i += 1) {
+      epoll_event ev = events[i];
+      if (ev.events & EPOLLOUT) {
+        flush(ev.data.fd);
+        ev.events &= ~static_cast<uint32_t>(EPOLLOUT);
+      }
+      if (ev.events == 0) { continue; }
+      events[kept] = ev;
+      kept += 1;
+    }
+    nfds = kept;
+    for (int fd : m_failed) {
+      auto it = std::find_if(events.begin(), events.begin() + nfds, [fd](const epoll_event &ev) { return ev.data.fd == fd; });
+      if (it != events.begin() + nfds) {
+        it->events |= EPOLLERR;
+        continue;
+      }
+      if (static_cast<size_t>(nfds) == events.size()) { events.resize(std::max(events.size() * 2, size_t(1))); }
+      events[nfds].events = EPOLLERR;
+      events[nfds].data.fd = fd;
+      nfds += 1;
+    }
+    m_failed.clear();
+  } while (nfds == 0);
+  return nfds;
+}
+int epoll_backend::accept(int listening_socket) {
+  return accept4(listening_socket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+ssize_t epoll_backend::recv(int fd, void *buf, size_t len, int flags) {
+  return ::recv(fd, buf, len, flags);
+}
+ssize_t epoll_backend::send(int fd, const void *buf, size_t len, int flags) {
+  socket_output &o = output(fd);
+  if (o.watched == false) { return ::send(fd, buf, len, flags | MSG_NOSIGNAL); }
+  if (o.error != 0) {
+    errno = o.error;
+    return -1;
+  }
+  if (o.queue.size() + len > max_pending_output) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  o.queue.push(buf, len);
+  queue_output(fd);
+  return static_cast<ssize_t>(len);
+}
+int epoll_backend::close(int fd) {
+  std::erase(m_failed, fd);
+  socket_output &o = output(fd);
+  //last words (a quit confirmation) are sent if the socket takes them right away
+  if (o.watched && o.error == 0) { o.queue.flush(fd); }
+  o.queue.clear();
+  o.watched = false;
+  return ::close(fd);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "io_backend.h"
+#include "output_queue.h"
+
+// readiness based, the reactor's handlers do the recv syscalls themselves
+// sends are queued per socket and written together, one sendmsg per socket, when the reactor goes back to waiting
+// EPOLLOUT is only asked for while a socket has output the kernel didn't take
+class epoll_backend : public io_backend {
+public:
+  static std::unique_ptr<io_backend> create();
+  ~epoll_backend() override;
+
+  const char *name() const override;
+  bool add_listener(int) override;
+  bool add_wakeup(int) override;
+  bool add(int) override;
+  int wait(std::vector<epoll_event> &) override;
+  int accept(int) override;
+  ssize_t recv(int, void *, size_t, int) override;
+  ssize_t send(int, const void *, size_t, int) override;
+  int close(int) override;
+private:
+  struct socket_output {
+    bool watched = false;
+    // waiting in m_pending_output
+    bool queued = false;
+    bool waiting_for_out = false;
+    // sending failed, with this errno, the next wait reports it as EPOLLERR
+    int error = 0;
+    output_queue queue;
+  };
+
+  epoll_backend(int);
+  bool add_with(int, uint32_t);
+  socket_output &output(int);
+  void queue_output(int);
+  // flushes every socket with pending output and (dis)arms EPOLLOUT to match what's left
+  void flush_output();
+  void flush(int);
+
+  int m_epoll_fd;
+  // indexed by fd
+  std::vector<socket_output> m_output;
+  std::vector<int> m_pending_output;
+  // sockets whose output failed, reported on the next wait
+  std::vector<int> m_failed;
+};
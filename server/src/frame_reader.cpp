@@ -0,0 +1,46 @@
+#include "frame_reader.h"
+
+#include "../../common/utils.h"
+#include "io_backend.h"
+
+#include <algorithm>
+
+frame_reader::state frame_reader::fill(int fd) {
+  //frames that were taken out don't have to be kept around anymore
+  if (m_begin == m_input.size()) {
+    m_input.clear();
+    m_begin = 0;
+  } else if (m_begin != 0) {
+    m_input.erase(m_input.begin(), m_input.begin() + static_cast<ssize_t>(m_begin));
+    m_begin = 0;
+  }
+
+  while (true) {
+    size_t old_size = m_input.size();
+    m_input.resize(old_size + read_size);
+    ssize_t recv_retval = io_backend::recv_socket(fd, m_input.data() + old_size, read_size, 0);
+    m_input.resize(old_size + static_cast<size_t>(std::max(recv_retval, ssize_t(0))));
+    if (recv_retval == 0) { return state::closed; }
+    if (recv_retval == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) { return state::open; }
+      return state::failed;
+    }
+    //a short read means the socket is empty, anything that arrives after it comes with a new event
+    if (static_cast<size_t>(recv_retval) < read_size) { return state::open; }
+  }
+}
+std::optional<std::span<const uint8_t>> frame_reader::next_frame() {
+  std::optional<std::span<const uint8_t>> retval = peek_frame();
+  if (retval.has_value()) { m_begin += retval->size(); }
+  return retval;
+}
+std::optional<std::span<const uint8_t>> frame_reader::peek_frame() const {
+  size_t available = m_input.size() - m_begin;
+  size_t length = get_frame_length(m_input.data() + m_begin, available);
+  if (length == 0 || length > available) { return std::nullopt; }
+  return std::span<const uint8_t>(m_input.data() + m_begin, length);
+}
+void frame_reader::clear() {
+  m_input.clear();
+  m_begin = 0;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <optional>
+#include <span>
+#include <vector>
+
+// the input of one connection, taken off the socket in as few reads as it allows and cut into the frames laid out in enums.h
+// a frame that didn't arrive whole stays here until the rest of it does
+class frame_reader {
+public:
+  enum class state {
+    open,
+    closed,
+    failed,
+  };
+
+  // reads everything the socket has right now, which is one recv unless more arrived than fits in a read
+  // frames read before the socket closed or failed can still be taken out, for failed errno is left as recv set it
+  state fill(int);
+  // the next whole frame, valid until the reader is used again
+  std::optional<std::span<const uint8_t>> next_frame();
+  // the same frame next_frame would give back, left in the reader
+  std::optional<std::span<const uint8_t>> peek_frame() const;
+  void clear();
+private:
+  static constexpr size_t read_size = 4096;
+
+  std::vector<uint8_t> m_input;
+  // everything before it was already taken out
+  size_t m_begin = 0;
+};
@@ -1,49 +1,27 @@
 #include "game.h"
 
-#include "big_poll.h"
-#include "player_queue.h"
 #include "../../common/utils.h"
+#include "big_poll.h"
+#include "user.h"
 
-#include <fcntl.h>
 #include <string.h>
 
 #include <random>
 #include <iostream>
+#include <utility>
 
-void game::start_game(int first_player, int second_player) {
-  int epoll_fd = epoll_create1(0);
-  if (epoll_fd == -1) {
-    error_print("start_game epoll_create");
-    disconnect_player_and_close(first_player);
-    disconnect_player_and_close(second_player);
-    return;
-  }
-
-  epoll_event ev;
-  ev.events = EPOLLIN | EPOLLET;
-  ev.data.fd = first_player;
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, first_player, &ev) == -1) {
-    error_print("start_game epoll_ctl add first_player");
-    disconnect_player_and_close(first_player);
-    disconnect_player_and_close(second_player);
-    if (close(epoll_fd) == -1) { error_print("start_game epoll_fd close"); }
-    return;
-  }
-
-  ev.events = EPOLLIN | EPOLLET;
-  ev.data.fd = second_player;
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, second_player, &ev) == -1) {
-    error_print("start_game epoll_ctl add second_player");
-    disconnect_player_and_close(first_player);
-    disconnect_player_and_close(second_player);
-    if (close(epoll_fd) == -1) { error_print("start_game epoll_fd close"); }
-    return;
-  }
+std::chrono::steady_clock::duration game::base_time = std::chrono::steady_clock::duration::zero();
+std::chrono::steady_clock::duration game::increment = std::chrono::steady_clock::duration::zero();
 
+void game::set_time_control(std::chrono::steady_clock::duration base, std::chrono::steady_clock::duration added) {
+  base_time = base;
+  increment = added;
+}
+void game::start_game(int first_player, uint32_t first_generation, int second_player, uint32_t second_generation) {
   bool t;
   {
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    //one generator per thread, seeding one for every game was a syscall per pairing
+    thread_local std::mt19937 gen { std::random_device()() };
 
     std::uniform_int_distribution distribution(0, 1);
 
@@ -51,64 +29,101 @@ void game::start_game(int first_player, int second_player) {
   }
   //true  -> first player is white, second player is black
   //false -> first player is black, second player is white
+  std::shared_ptr<game> new_game(t ? new game(first_player, first_generation, second_player, second_generation)
+                                   : new game(second_player, second_generation, first_player, first_generation));
 
-  message first_message = (t ? message::white : message::black);
-  ssize_t send_retval = send(first_player, &first_message, sizeof(message), 0);
-  if (send_retval == -1 || send_retval == 0) {
-    if (send_retval == -1) { user::recv_send_fail_handler(first_player, "start_game white player color send"); }
-    else { disconnect_player_and_close(first_player); }
-
-    if (fcntl(second_player, F_GETFD) == -1 && errno == EBADFD) {
-      user::disconnectUser(second_player);
-    } else {
-      fprintf(stderr, "relocating the black file descriptor %d back to the queue\n", second_player);
-      player_queue::add_socket(second_player);
+  //a player whose colour can't be sent is closed, its reactor then finds it gone when it's asked to put it in the game
+  //and the game plays that like a hangup
+  //nobody else knows about the game until it's joined, so it isn't locked here (joining can lock it)
+  for (size_t i = 0; i < 2; i += 1) {
+    message colour = (i == 0 ? message::white : message::black);
+    ssize_t send_retval = new_game->send_to(new_game->m_players[i], &colour, sizeof(message));
+    if (send_retval == -1 || send_retval == 0) {
+      if (send_retval == -1) { error_print("start_game player color send"); }
+      big_poll::close_socket(new_game->m_players[i], new_game->m_generations[i]);
     }
-
-    if (close(epoll_fd) == -1) { error_print("start_game epoll_fd close"); }
-    return;
   }
-
-  message second_message = (t ? message::black : message::white);
-  send_retval = send(second_player, &second_message, sizeof(message), 0);
-  if (send_retval == -1 || send_retval == 0) {
-    if (send_retval == -1) { user::recv_send_fail_handler(second_player, "start_game black player color send"); }
-    else { disconnect_player_and_close(first_player); }
-
-    if (fcntl(first_player, F_GETFD) == -1 && errno == EBADFD) {
-      user::disconnectUser(first_player);
-    } else {
-      fprintf(stderr, "relocating the white file descriptor %d back to the queue\n", first_player);
-      player_queue::add_socket(first_player);
-    }
-
-    if (close(epoll_fd) == -1) { error_print("start_game epoll_fd close"); }
+  fprintf(stderr, "started game between %d and %d\n", new_game->m_players[0], new_game->m_players[1]);
+  for (size_t i = 0; i < 2; i += 1) {
+    big_poll::join_game(new_game->m_players[i], new_game->m_generations[i], new_game);
+  }
+}
+std::unique_lock<std::mutex> game::lock() {
+  return std::unique_lock(m_mutex);
+}
+bool game::is_over() const {
+  return m_over;
+}
+std::optional<std::chrono::steady_clock::duration> game::time_left(int fd) const {
+  if (base_time == std::chrono::steady_clock::duration::zero()) { return std::nullopt; }
+  size_t idx = player_index(fd);
+  std::chrono::steady_clock::duration retval = m_clocks[idx];
+  if (m_players[static_cast<bool>(m_board.turn())] == fd) { retval -= std::chrono::steady_clock::now() - m_turn_started; }
+  return retval;
+}
+void game::seat_player(int fd, std::string_view username, const rating &r) {
+  m_seats[player_index(fd)] = seat { std::string(username), r, std::nullopt };
+}
+std::optional<rating> game::rating_after(int fd) const {
+  const std::optional<seat> &s = m_seats[player_index(fd)];
+  if (s.has_value() == false) { return std::nullopt; }
+  return s->after;
+}
+void game::set_winner(int fd) {
+  m_score = player_index(fd) == 0 ? 1 : 0;
+}
+void game::set_draw() {
+  m_score = 0.5;
+}
+void game::rate() {
+  if (m_seats[0].has_value() == false || m_seats[1].has_value() == false) {
+    fprintf(stderr, "game between %d and %d ended before both players joined, it isn't rated\n", m_players[0], m_players[1]);
     return;
   }
-
-  game instance(t ? first_player : second_player, t ? second_player : first_player);
-  instance.play_game(epoll_fd);
+  //both new ratings come from the ratings before the game
+  m_seats[0]->after = m_seats[0]->before.after_game(m_seats[1]->before, m_score);
+  m_seats[1]->after = m_seats[1]->before.after_game(m_seats[0]->before, 1 - m_score);
+  for (const std::optional<seat> &s : m_seats) {
+    fprintf(stderr, "%s is rated %.0f (deviation %.0f), was %.0f (deviation %.0f)\n",
+            s->username.c_str(), s->after->value, s->after->deviation, s->before.value, s->before.deviation);
+    //the writer puts it in users.txt later, the disk is never touched here
+    user::save_rating(s->username, *s->after);
+  }
+}
+bool game::flag_fell(int fd, std::chrono::steady_clock::time_point now) const {
+  return base_time != std::chrono::steady_clock::duration::zero() && now - m_turn_started >= m_clocks[player_index(fd)];
 }
 void game::disconnect_player_and_close(int fd) {
-  user::disconnectUser(fd);
-  if (close(fd) == -1) { error_print("player close"); }
+  //the reactor the socket lives in logs the user out when it closes it
+  big_poll::close_socket(fd, m_generations[player_index(fd)]);
+}
+void game::recv_send_fail_handler(int fd, std::string_view message, int err) {
+  error_print(message, err);
+  disconnect_player_and_close(fd);
+}
+void game::return_to_lobby(int fd) {
+  size_t idx = player_index(fd);
+  m_back_to_lobby.push_back({ fd, m_generations[idx], m_drop_next_frame[idx] });
+}
+const std::vector<game::leaving_player> &game::players_back_to_lobby() const {
+  return m_back_to_lobby;
 }
 void game::handle_abort(int fd) {
   message to_send = message::confirmation;
-  ssize_t send_retval = send(fd, &to_send, sizeof(message), 0);
+  ssize_t send_retval = send_to(fd, &to_send, sizeof(message));
   if (send_retval == -1 || send_retval == 0) {
-    if (send_retval == -1) { user::recv_send_fail_handler(fd, "player abort confirmation send"); }
+    if (send_retval == -1) { recv_send_fail_handler(fd, "player abort confirmation send"); }
     else { disconnect_player_and_close(fd); }
   } else {
     fprintf(stderr, "successfully forfeited the match for player %d\n", fd);
-    big_poll::add_socket(fd);
+    return_to_lobby(fd);
   }
 }
 void game::handle_quit(int fd) {
   message to_send = message::confirmation;
-  ssize_t send_retval = send(fd, &to_send, sizeof(message), 0);
+  ssize_t send_retval = send_to(fd, &to_send, sizeof(message));
   if (send_retval == -1 || send_retval == 0) {
-    if (send_retval == -1) { user::recv_send_fail_handler(fd, "player quit confirmation send"); }
+    if (send_retval == -1) { recv_send_fail_handler(fd, "player quit confirmation send"); }
     else { disconnect_player_and_close(fd); }
   } else {
     fprintf(stderr, "successfully exited the match (and the game) for player %d\n", fd);
@@ -116,427 +131,191 @@ void game::handle_quit(int fd) {
   }
 }
 void game::handle_opponent_disconnect(int fd, message to_send) {
-  ssize_t send_retval = send(fd, &to_send, sizeof(message), 0);
+  ssize_t send_retval = send_to(fd, &to_send, sizeof(message));
   if (send_retval == -1 || send_retval == 0) {
-    if (send_retval == -1) { user::recv_send_fail_handler(fd, "player forfeit send"); }
+    if (send_retval == -1) { recv_send_fail_handler(fd, "player forfeit send"); }
     else { disconnect_player_and_close(fd); }
   } else {
     fprintf(stderr, "successfully send player %d to the main menu\n", fd);
-    big_poll::add_socket(fd);
+    return_to_lobby(fd);
   }
 }
-ssize_t game::send_move(int fd, message msg, std::array<uint8_t, 3> moveset, int flags) {
+ssize_t game::send_to(int fd, const void *buf, size_t len) {
+  return big_poll::send_socket(fd, m_generations[player_index(fd)], buf, len);
+}
+ssize_t game::send_move(int fd, message msg, std::array<uint8_t, 3> moveset) {
   char sendbuf[sizeof(message) + 3 * sizeof(uint8_t)];
   memcpy(sendbuf, &msg, sizeof(message));
   memcpy(sendbuf + sizeof(message), moveset.data(), 3 * sizeof(uint8_t));
-  return send(fd, sendbuf, sizeof(message) + 3 * sizeof(uint8_t), flags);
+  return send_to(fd, sendbuf, sizeof(message) + 3 * sizeof(uint8_t));
 }
-bool game::consume_message(int fd) {
-  char buf[4];
-  ssize_t recv_retval = recv(fd, buf, 4, MSG_DONTWAIT);
-  if (recv_retval == 0 || (recv_retval == -1 && errno != EWOULDBLOCK && errno != EAGAIN)) {
-    fprintf(stderr, "failed to exhaust the contents of %d\n", fd);
-    if (recv_retval == -1) { user::recv_send_fail_handler(fd, "player forfeit send"); }
-    else { disconnect_player_and_close(fd); }
-    return false;
-  }
-  return true;
+void game::consume_message(int fd) {
+  m_drop_next_frame[player_index(fd)] = true;
 }
-game::game(int first_player, int second_player) : m_players({first_player, second_player}), m_board() {}
-void game::play_game(int epoll_fd) {
-  while (true) {
-    std::array<epoll_event, 2> player_events;
-    int nfds;
-    while ((nfds = epoll_wait(epoll_fd, player_events.data(), 2, -1)) == -1 && errno != EINTR) {}
-    if (nfds == -1) {
-      error_print("okay_game epoll_wait");
-      disconnect_both_players_and_poll(epoll_fd);
-      return;
-    }
-    if (nfds == 0) {
-      disconnect_both_players_and_poll(epoll_fd);
-      return;
+void game::handle_flag_fall(int fd) {
+  fprintf(stderr, "player %d ran out of time\n", fd);
+  //the player could be sending a move and the opponent an abort or a quit right now
+  int other_fd = get_other_player(fd);
+  set_winner(other_fd);
+  consume_message(fd);
+  consume_message(other_fd);
+  for (auto [player, result] : { std::pair(fd, message::lost), std::pair(other_fd, message::won) }) {
+    ssize_t send_retval = send_to(player, &result, sizeof(message));
+    if (send_retval == -1 || send_retval == 0) {
+      if (send_retval == -1) { recv_send_fail_handler(player, "flag fall result send"); }
+      else { disconnect_player_and_close(player); }
+    } else {
+      return_to_lobby(player);
     }
-    //
-    // E - epoll error
-    // R - recv error
-    // A - recv returned message::abort_match
-    // Q - recv returned message::quit
-    // M - recv returned message::move
-    // O - recv returned anything else (client compromised)
-    if (nfds == 2) {
-      std::array<int, 2> player_fd = { player_events[0].data.fd, player_events[1].data.fd };
-      std::array<bool, 2> player_ev_err = { static_cast<bool>(player_events[0].events & (EPOLLPRI | EPOLLERR | EPOLLRDHUP | EPOLLHUP)),
-                                            static_cast<bool>(player_events[1].events & (EPOLLPRI | EPOLLERR | EPOLLRDHUP | EPOLLHUP)) };
-      std::array<message, 2> player_message;
-      std::array<ssize_t, 2> player_recv_retval;
-      std::array<int, 2> player_errno;
-      bool turn_of = static_cast<bool>(m_board.turn());
-      if (player_fd[0] != m_players[0]) {
-        turn_of = !turn_of;
-      }
-      for (size_t i = 0; i < 2; i += 1) {
-        if (player_ev_err[i] == false) {
-          player_recv_retval[i] = recv(player_fd[i], &player_message[i], sizeof(message), 0);
-          if (player_recv_retval[i] == 0) { player_ev_err[i] = true; }
-          player_errno[i] = errno;
-        }
-      }
-      // to | nto
-      //----+-----
-      // E  | E
-      if (player_ev_err[0] && player_ev_err[1]) {
-        fprintf(stderr, "both players are erronious, will cancel the match and disconnect both of them (%d and %d)\n", m_players[0], m_players[1]);
-        disconnect_both_players_and_poll(epoll_fd);
-        return;
-      }
-      // to | nto
-      //----+-----
-      // R  | R
-      if (player_recv_retval[0] == -1 && player_recv_retval[1] == -1) {
-        for (size_t i = 0; i < 2; i += 1) {
-          user::recv_send_fail_handler(player_fd[i], "player message recv", player_errno[i]);
-        }
-        if (close(epoll_fd) == -1) { error_print("play_game 2 msg poll close"); }
-        return;
-      }
-      // to | nto
-      //----+-----
-      // E  | R
-      // R  | E
-      for (size_t j = 0; j < 2; j += 1) {
-        bool i = static_cast<bool>(j);
-        if (player_ev_err[i] && player_recv_retval[!i] == -1) {
-          disconnect_player_and_close(player_fd[i]);
-          user::recv_send_fail_handler(player_fd[!i], "player message recv", player_errno[!i]);
-          if (close(epoll_fd) == -1) { error_print("play_game 2 msg poll close"); }
-          return;
-        }
-      }
-      // to | nto
-      //----+-----
-      // E  | A
-      // E  | Q
-      // E  | M
-      // E  | O
-      // A  | E
-      // Q  | E
-      // O  | E
-      for (size_t j = 0; j < 2; j += 1) {
-        bool i = static_cast<bool>(j);
-        if (player_ev_err[i]) {
-          if (player_message[!i] == message::abort_match) {
-            disconnect_player_and_close(player_fd[i]);
-            handle_abort(player_fd[!i]);
-            if (close(epoll_fd) == -1) { error_print("invalid message poll close"); }
-            return;
-          } else if (player_message[!i] == message::quit) {
-            disconnect_player_and_close(player_fd[i]);
-            handle_quit(player_fd[!i]);
-            if (close(epoll_fd) == -1) { error_print("invalid message poll close"); }
-            return;
-          } else if (i == turn_of || player_message[!i] != message::move) {
-            // if it's i's turn then any other mesages are invalid
-            // if it's not i's turn then any messages except move are invalid
-            // i == turn_of || (!i == turn_of && player_message[!i] != message::move)
-            // i == turn_of || (i != turn_of && player_message[!i] != message::move)
-            std::cerr << "recieved invalid message (" << get_message_as_text(player_message[!i]) << ") from socket ";
-            std::cerr << player_fd[!i] << "; since the other socket is already invalid both sockets will be disconnected" << std::endl;
-            disconnect_both_players_and_poll(epoll_fd);
-            return;
-          }
-        }
-      }
-      // to | nto
-      //----+-----
-      // R  | A
-      // R  | Q
-      // R  | M
-      // R  | O
-      // A  | R
-      // Q  | R
-      // O  | R
-      for (size_t j = 0; j < 2; j += 1) {
-        bool i = static_cast<bool>(j);
-        if (player_recv_retval[i] == -1) {
-          if (player_message[!i] == message::abort_match) {
-            user::recv_send_fail_handler(player_fd[i], "player message recv", player_errno[i]);
-            handle_abort(player_fd[!i]);
-            if (close(epoll_fd) == -1) { error_print("invalid message poll close"); }
-            return;
-          } else if (player_message[!i] == message::quit) {
-            user::recv_send_fail_handler(player_fd[i], "player message recv", player_errno[i]);
-            handle_abort(player_fd[!i]);
-            if (close(epoll_fd) == -1) { error_print("invalid message poll close"); }
-            return;
-          } else if (!(!i == turn_of && player_message[!i] == message::move)) {
-            //loof at the previous for loop if you don't understand this cpondition
-            std::cerr << "recieved invalid message (" << get_message_as_text(player_message[!i]) << ") from socket ";
-            std::cerr << player_fd[!i] << "; since the other socket is already invalid both sockets will be disconnected" << std::endl;
-            user::recv_send_fail_handler(player_fd[i], "player message recv", player_errno[i]);
-            disconnect_player_and_close(player_fd[!i]);
-            if (close(epoll_fd) == -1) { error_print("invalid message poll close"); }
-            return;
-          }
-        }
-      }
-      //at this point, turn_of does not have errors
-
-      // to | nto
-      //----+-----
-      // M  | E
-      // M  | R
-      // M  | A
-      // M  | Q
-      // M  | M
-      // M  | O
-      if (player_message[turn_of] == message::move) {
-        bool is_abort_or_quit = false;
-        if (player_ev_err[!turn_of]) {
-          // E
-          disconnect_player_and_close(player_fd[!turn_of]);
-        } else if (player_recv_retval[!turn_of] == -1) {
-          // R
-          user::recv_send_fail_handler(player_fd[!turn_of], "player message recv", player_errno[!turn_of]);
-        } else if (player_message[!turn_of] != message::abort_match && player_message[!turn_of] != message::quit) {
-          // M and O
-          std::cerr << "recieved invalid message (" << get_message_as_text(player_message[!turn_of]) << ") from socket ";
-          std::cerr << player_fd[!turn_of] << "; it'll be disconnected" << std::endl;
-          disconnect_player_and_close(player_fd[!turn_of]);
-        } else {
-          is_abort_or_quit = true;
-        }
-
-        std::array<uint8_t, 3> moveset;
-        ssize_t recv_retval = recv(player_fd[turn_of], moveset.data(), 3 * sizeof(uint8_t), 0);
-        if (recv_retval == -1 || recv_retval == 0) {
-          if (recv_retval == -1) { user::recv_send_fail_handler(player_fd[turn_of], "player move recv"); }
-          else { disconnect_player_and_close(player_fd[turn_of]); }
-
-          if (is_abort_or_quit) {
-            if (player_message[!turn_of] == message::abort_match) {
-              handle_abort(player_fd[!turn_of]);
-            } else  if (player_message[!turn_of] == message::quit) {
-              handle_quit(player_fd[!turn_of]);
-            }
-          }
-          if (close(epoll_fd) == -1) { error_print("play_game 2 msg poll close"); }
-          return;
-        }
-        auto &&[source, destination, promotion] = destructured_move(moveset);
-        //for mover:
-        // won -> won
-        // draw -> draw
-        // confirmation -> forfeit
-        // rejection -> forfeit
-
-        message move_retval = m_board.check_move(source, destination, promotion);
-        message to_send_to_mover = move_retval;
-        if (move_retval == message::confirmation || move_retval == message::rejection) {
-          to_send_to_mover = message::forfeit;
-        }
-        handle_opponent_disconnect(player_fd[turn_of], to_send_to_mover);
-
-        if (is_abort_or_quit) {
-          //for optional forfeiter:
-          // won -> lost + move
-          // draw -> draw + move
-          // confirmation -> confirmation + move
-          // rejection -> confirmation
-          message to_send_to_forfeiter = move_retval;
-          if (move_retval == message::won) {
-            to_send_to_forfeiter = message::lost;
-          }
-          if (move_retval == message::rejection) {
-            to_send_to_forfeiter = message::confirmation;
-          }
-          ssize_t send_retval;
-          if (move_retval != message::rejection) {
-            //add moveset to the forfeiter message if it loses or draws
-            send_retval = send_move(player_fd[!turn_of], to_send_to_forfeiter, moveset);
-          } else {
-            send_retval = send(player_fd[!turn_of], &to_send_to_forfeiter, sizeof(message), 0);
-          }
-          if (send_retval == -1 || send_retval == 0) {
-            if (send_retval == -1) { user::recv_send_fail_handler(player_fd[!turn_of], "forfeiter move/confirmation send"); }
-            else { disconnect_player_and_close(player_fd[!turn_of]); }
-          } else {
-            if (player_message[!turn_of] == message::abort_match) {
-              fprintf(stderr, "successfully forfeited the match for player %d\n", player_fd[!turn_of]);
-              big_poll::add_socket(player_fd[!turn_of]);
-            } else if (player_message[!turn_of] == message::quit) {
-              fprintf(stderr, "successfully exited the match for player %d\n", player_fd[!turn_of]);
-              disconnect_player_and_close(player_fd[!turn_of]);
-            }
-          }
-        }
-        if (close(epoll_fd) == -1) { error_print("play_game 2 msg poll close"); }
-        return;
-      }
-      //at this point, all E and R cases have been treated on both sides
-
-      // to | nto
-      //----+-----
-      // A  | A
-      // A  | Q
-      // Q  | A
-      // Q  | Q
-      if ((player_message[0] == message::abort_match || player_message[0] == message::quit) && (player_message[1] == message::abort_match || player_message[1] == message::quit)) {
-        for (size_t i = 0; i < 2; i += 1) {
-          if (player_message[i] == message::abort_match) {
-            handle_abort(player_fd[i]);
-          } else {
-            handle_quit(player_fd[i]);
-          }
-        }
-        if (close(epoll_fd) == -1) { error_print("play_game 2 msg poll close"); }
-        return;
-      }
-      //at this point, both sides are a message, but not both are valid messages
+  }
+}
+game::game(int first_player, uint32_t first_generation, int second_player, uint32_t second_generation)
+  : m_players({first_player, second_player}), m_generations({first_generation, second_generation}),
+    m_clocks({base_time, base_time}), m_turn_started(std::chrono::steady_clock::now()) {
+  m_board = board().pack(m_history);
+}
+bool game::play_turn(const player_input &input) {
+  m_over = play_frame(input);
+  if (m_over) { rate(); }
+  return m_over;
+}
+bool game::play_frame(const player_input &input) {
+  //
+  // E - epoll error
+  // R - recv error
+  // A - recv returned message::abort_match
+  // Q - recv returned message::quit
+  // M - recv returned message::move
+  // O - recv returned anything else (client compromised)
+  // T - the player's clock ran out
+  //the players' frames are played one at a time in the order the game lock was taken, so only one side is ever looked at
+  int active_fd = input.fd;
+  int other_fd = get_other_player(active_fd);
+  if (input.flag_fell) {
+    handle_flag_fall(active_fd);
+    return true;
+  }
+  //whoever leaves a game loses it
+  if (input.hung_up) {
+    set_winner(other_fd);
+    disconnect_player_and_close(active_fd);
+    consume_message(other_fd);
+    handle_opponent_disconnect(other_fd);
+    return true;
+  }
+  if (input.recv_failed) {
+    set_winner(other_fd);
+    recv_send_fail_handler(active_fd, "player message recv", input.recv_errno);
 
-      // to | nto
-      //----+-----
-      // A  | M
-      // A  | O
-      // Q  | M
-      // Q  | O
-      // O  | A
-      // O  | Q
-      for (size_t j = 0; j < 2; j += 1) {
-        bool i = static_cast<bool>(j);
-        if (player_message[i] == message::abort_match) {
-          handle_abort(player_fd[i]);
-        } else if (player_message[i] == message::quit) {
-          handle_quit(player_fd[i]);
-        } else { continue; }
-        std::cerr << "recieved invalid message (" << get_message_as_text(player_message[!i]);
-        std::cerr << ") from socket " << player_fd[!i] << "; it'll be disconnected" << std::endl;
-        disconnect_player_and_close(player_fd[!i]);
-        if (close(epoll_fd) == -1) { error_print("play_game 2 msg poll close"); }
-        return;
-      }
-      // to | nto
-      //----+-----
-      // O  | M
-      // O  | O
-      std::cerr << "recieved invalid messages (" << get_message_as_text(player_message[0]) << " and " << get_message_as_text(player_message[1]);
-      std::cerr << ") from both sockets (" << player_fd[0] << " and " << player_fd[1] << "); will cancel the match and disconnect both of them" << std::endl;
-      disconnect_both_players_and_poll(epoll_fd);
-      return;
+    consume_message(other_fd);
+    handle_opponent_disconnect(other_fd);
+    return true;
+  }
+  message to_recv = input.m;
+  if (to_recv != message::move || (to_recv == message::move && active_fd != m_players[static_cast<bool>(m_board.turn())])) {
+    set_winner(other_fd);
+    if (to_recv == message::abort_match) {
+      handle_abort(active_fd);
+    } else if (to_recv == message::quit) {
+      handle_quit(active_fd);
+    } else {
+      std::cerr << "recieved invalid message (" << get_message_as_text(to_recv) << ") from socket ";
+      std::cerr << active_fd << ", so it'll be disconnected" << std::endl;
+      disconnect_player_and_close(active_fd);
     }
-    if (nfds == 1) {
-      int active_fd = player_events[0].data.fd;
-      int other_fd = get_other_player(active_fd);
-      if (player_events[0].events & (EPOLLPRI | EPOLLERR | EPOLLRDHUP | EPOLLHUP)) {
-        disconnect_player_and_close(active_fd);
-        if (consume_message(other_fd)) { handle_opponent_disconnect(other_fd); }
-        if (close(epoll_fd) == -1) { error_print("poll close"); }
-        return;
-      }
-      message to_recv;
-      ssize_t recv_retval = recv(active_fd, &to_recv, sizeof(message), 0);
-      if (recv_retval == -1 || recv_retval == 0) {
-        if (recv_retval == -1 ) { user::recv_send_fail_handler(active_fd, "player message recv"); }
-        else { disconnect_player_and_close(active_fd); }
-
-        if (consume_message(other_fd)) { handle_opponent_disconnect(other_fd); }
-        if (close(epoll_fd) == -1) { error_print("poll close"); }
-        return;
-      }
-      if (to_recv != message::move || (to_recv == message::move && active_fd != m_players[static_cast<bool>(m_board.turn())])) {
-        if (to_recv == message::abort_match) {
-          handle_abort(active_fd);
-        } else if (to_recv == message::quit) {
-          handle_quit(active_fd);
-        } else {
-          std::cerr << "recieved invalid message (" << get_message_as_text(to_recv) << ") from socket ";
-          std::cerr << active_fd << ", so it'll be disconnected" << std::endl;
-          disconnect_player_and_close(active_fd);
-        }
-        if (consume_message(other_fd)) { handle_opponent_disconnect(other_fd); }
-        if (close(epoll_fd) == -1) { error_print("poll close"); }
-        return;
-      }
-      std::array<uint8_t, 3> moveset;
-      recv_retval = recv(active_fd, moveset.data(), 3 * sizeof(uint8_t), 0);
-      if (recv_retval == -1 || recv_retval == 0) {
-        if (recv_retval == -1) { user::recv_send_fail_handler(active_fd, "player move recv"); }
-        else { disconnect_player_and_close(active_fd); }
-
-        if (consume_message(other_fd)) { handle_opponent_disconnect(other_fd); }
-        if (close(epoll_fd) == -1) { error_print("poll close"); }
-        return;
-      }
-      auto &&[source, destination, promotion] = destructured_move(moveset);
+    consume_message(other_fd);
+    handle_opponent_disconnect(other_fd);
+    return true;
+  }
+  //a move that comes in after the clock ran out loses, even if the reactor's timer didn't go off yet
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  if (flag_fell(active_fd, now)) {
+    handle_flag_fall(active_fd);
+    return true;
+  }
+  std::array<uint8_t, 3> moveset = input.moveset;
+  auto &&[source, destination, promotion] = destructured_move(moveset);
 
-      message move_retval = m_board.check_move(source, destination, promotion);
-      message to_send = move_retval;
-      ssize_t send_retval = send(active_fd, &move_retval, sizeof(message), 0);
-      if (send_retval == -1 || send_retval == 0) {
-        if (send_retval == -1) { user::recv_send_fail_handler(active_fd, "move validity send"); }
-        else { disconnect_player_and_close(active_fd); }
-        if (consume_message(other_fd)) {
-          // won -> lost + moveset
-          // draw -> draw + moveset
-          // confirmation -> forfeit + moveset
-          // rejection -> forfeit
-          if (move_retval == message::won) {
-            to_send = message::lost;
-          } else if (move_retval == message::confirmation || move_retval == message::rejection) {
-            to_send = message::forfeit;
-          }
-          if (move_retval != message::rejection) {
-            send_retval = send_move(other_fd, to_send, moveset);
-          } else {
-            send_retval = send(other_fd, &to_send, sizeof(message), 0);
-          }
-          if (send_retval == -1 || send_retval == 0) {
-            if (send_retval == -1) { user::recv_send_fail_handler(other_fd, "other player forfeit/lost/draw send"); }
-            else { disconnect_player_and_close(other_fd); }
-          } else {
-            big_poll::add_socket(other_fd);
-          }
-        }
-        if (close(epoll_fd) == -1) { error_print("poll close"); }
-        return;
-      }
-      //normal message for opposing player
-      // won -> lost + moveset
-      // draw -> draw + moveset
-      // confirmation -> move + moveset
-      // rejection -> 
-      if (move_retval == message::won) {
-        to_send = message::lost;
-      } else if (move_retval == message::confirmation) {
-        to_send = message::move;
-      }
+  message move_retval = check_move(source, destination, promotion);
+  if (move_retval == message::confirmation) {
+    size_t idx = player_index(active_fd);
+    m_clocks[idx] += increment - (now - m_turn_started);
+    m_turn_started = now;
+  }
+  message to_send = move_retval;
+  ssize_t send_retval = send_to(active_fd, &move_retval, sizeof(message));
+  if (send_retval == -1 || send_retval == 0) {
+    if (send_retval == -1) { recv_send_fail_handler(active_fd, "move validity send"); }
+    else { disconnect_player_and_close(active_fd); }
+    consume_message(other_fd);
+    // won -> lost + moveset
+    // draw -> draw + moveset
+    // confirmation -> forfeit + moveset
+    // rejection -> forfeit
+    if (move_retval == message::won) {
+      to_send = message::lost;
+      set_winner(active_fd);
+    } else if (move_retval == message::confirmation || move_retval == message::rejection) {
+      to_send = message::forfeit;
+      set_winner(other_fd);
+    } else {
+      set_draw();
+    }
+    if (move_retval != message::rejection) {
+      send_retval = send_move(other_fd, to_send, moveset);
+    } else {
+      send_retval = send_to(other_fd, &to_send, sizeof(message));
+    }
+    if (send_retval == -1 || send_retval == 0) {
+      if (send_retval == -1) { recv_send_fail_handler(other_fd, "other player forfeit/lost/draw send"); }
+      else { disconnect_player_and_close(other_fd); }
+    } else {
+      return_to_lobby(other_fd);
+    }
+    return true;
+  }
+  //normal message for opposing player
+  // won -> lost + moveset
+  // draw -> draw + moveset
+  // confirmation -> move + moveset
+  // rejection -> 
+  if (move_retval == message::won) {
+    to_send = message::lost;
+  } else if (move_retval == message::confirmation) {
+    to_send = message::move;
+  }
 
-      if (move_retval != message::rejection) {
-        send_retval = send_move(other_fd, to_send, moveset);
-        if (send_retval == -1 || send_retval == 0) {
-          if (send_retval == -1) { user::recv_send_fail_handler(other_fd, "player send move"); }
-          else { disconnect_player_and_close(other_fd); }
+  if (move_retval != message::rejection) {
+    send_retval = send_move(other_fd, to_send, moveset);
+    if (send_retval == -1 || send_retval == 0) {
+      if (send_retval == -1) { recv_send_fail_handler(other_fd, "player send move"); }
+      else { disconnect_player_and_close(other_fd); }
 
-          handle_opponent_disconnect(active_fd);
-          if (close(epoll_fd) == -1) { error_print("poll close"); }
-          return;
-        }
-        if (move_retval != message::confirmation) {
-          big_poll::add_socket(active_fd);
-          big_poll::add_socket(other_fd);
-          if (close(epoll_fd) == -1) { error_print("poll close"); }
-          return;
-        }
-      }
+      //the move stands even if the opponent can't be told about it
+      if (move_retval == message::draw) { set_draw(); }
+      else { set_winner(active_fd); }
+      handle_opponent_disconnect(active_fd);
+      return true;
+    }
+    if (move_retval != message::confirmation) {
+      if (move_retval == message::won) { set_winner(active_fd); }
+      else { set_draw(); }
+      return_to_lobby(active_fd);
+      return_to_lobby(other_fd);
+      return true;
     }
   }
+  return false;
+}
+message game::check_move(coords source, coords destination, promotion p) {
+  board expanded(m_board, m_history);
+  message retval = expanded.check_move(source, destination, p);
+  m_board = expanded.pack(m_history);
+  return retval;
+}
+size_t game::player_index(int fd) const {
+  return fd == m_players[0] ? 0 : 1;
 }
 int game::get_other_player(int fd) {
   return fd != m_players[0] ? m_players[0] : m_players[1];
 }
-void game::disconnect_both_players_and_poll(int epoll_fd) {
-  for (int player_fd : m_players) {
-    disconnect_player_and_close(player_fd);
-  }
-  if (close(epoll_fd) == -1) { error_print("disconnect_both_players_and_poll poll close"); }
-}
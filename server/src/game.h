@@ -2,59 +2,140 @@
 
 #include "../../common/enums.h"
 #include "board.h"
+#include "rating.h"
 
-//
+#include <stdint.h>
 
 #include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <vector>
 
+// one match between two players whose sockets can live in different big_poll reactors
+// each reactor plays what its own player sent with the game locked, anything for the other player is routed through big_poll
 class game {
 public:
-  static void start_game(int, int);
+  // one player's part of a turn: a whole frame or the reason there won't be one
+  struct player_input {
+    int fd = -1;
+    // E: the socket hung up or got an error event
+    bool hung_up = false;
+    // R: reading from or writing to the socket failed
+    bool recv_failed = false;
+    int recv_errno = 0;
+    // T: the player's clock ran out, its reactor's clock timer found it
+    bool flag_fell = false;
+    message m = message::move;
+    std::array<uint8_t, 3> moveset = {};
+  };
+  // a player the game sent back to the lobby when it ended
+  struct leaving_player {
+    int fd;
+    uint32_t generation;
+    // a frame the player sent before it learned the game is over, dropped instead of being handled by the lobby
+    bool drop_next_frame;
+  };
+
+  // sends both players (fd and connection generation) their colours and has their reactors put them in the game
+  // can be called from any thread
+  static void start_game(int, uint32_t, int, uint32_t);
+  // every game after this gets the base time on both clocks and the increment added after every move, untimed if the base time is 0
+  static void set_time_control(std::chrono::steady_clock::duration, std::chrono::steady_clock::duration);
+  // has to be held around everything else
+  std::unique_lock<std::mutex> lock();
+  // plays one frame (or the hangup) of one of the players
+  // returns true once the game is over, both players have then either been closed or are in players_back_to_lobby
+  bool play_turn(const player_input &);
+  bool is_over() const;
+  // what's left on the player's clock, counting the turn it's on if it's the player's, nullopt if the game isn't timed
+  std::optional<std::chrono::steady_clock::duration> time_left(int) const;
+  // called by the player's reactor when it joins, with the player's username and rating
+  // a game is only rated if both players joined before it ended
+  void seat_player(int, std::string_view, const rating &);
+  // the player's rating once the game is over, nullopt if it wasn't rated
+  std::optional<rating> rating_after(int) const;
+  const std::vector<leaving_player> &players_back_to_lobby() const;
+  ~game() = default;
 private:
+  // returns true if the frame (or hangup) ended the game
+  bool play_frame(const player_input &);
   // will disconnect the user and close its socket
-  static void disconnect_player_and_close(int);
+  void disconnect_player_and_close(int);
+  // prints the error, then does the same as disconnect_player_and_close
+  void recv_send_fail_handler(int, std::string_view, int = errno);
   // used for sockets that recieved a abort_match message
   // sends a confirmation message
-  // if send fails, it disconnects the user and closes its socket through the user recv_send_fail_handler or disconnect_player_and_close
-  // otherwise the socket is placed in the big_poll
-  static void handle_abort(int);
+  // if send fails, it disconnects the user and closes its socket through recv_send_fail_handler or disconnect_player_and_close
+  // otherwise the socket is sent back to the lobby
+  void handle_abort(int);
   // used for sockets that recieved a quit message
   // sends a confirmation message
-  // if send fails, it disconnects the user and closes its socket through the user recv_send_fail_handler or disconnect_player_and_close
+  // if send fails, it disconnects the user and closes its socket through recv_send_fail_handler or disconnect_player_and_close
   // otherwise it does the same thing but with disconnect_player_and_close
-  // the main differnces between recv_send_fail_handler and disconnect_player_and_close is that
-  // the former prints an eror message and checks if the socket is still valid
-  static void handle_quit(int);
+  void handle_quit(int);
   // used when the opponent disconnects
   // sends the message if one is passed, or forfeit
   // if send fails, it disconnects the user and closes its socket with recv_send_fail_handler or disconnect_player_and_close
-  // otherwise the socket is placed in the big_poll
-  static void handle_opponent_disconnect(int, message = message::forfeit);
-  // consumes the message
-  // if recv fails, it disconnects the user and closes its socket through the user recv_send_fail_handler or disconnect_player_and_close, then returns false
-  // else returns true
-  static bool consume_message(int);
+  // otherwise the socket is sent back to the lobby
+  void handle_opponent_disconnect(int, message = message::forfeit);
+  // the player might have sent a frame before learning the game is over, the lobby drops it if it's already there
+  void consume_message(int);
+  // sends lost to the player whose clock ran out and won to the other one
+  // the ones it can send to are sent back to the lobby, the others are closed
+  void handle_flag_fall(int);
+  // these keep the result for rate
+  void set_winner(int);
+  void set_draw();
+  // works out both players' new ratings and has them saved, once the game is over
+  void rate();
+  // true if the player's clock ran out, only called on the player's turn
+  bool flag_fell(int, std::chrono::steady_clock::time_point) const;
+  // sends to the player through big_poll, which routes it to the reactor the player's socket lives in
+  ssize_t send_to(int, const void *, size_t);
   // this is its own function only because it repeats 3 times
   // basically sends message and moveset in a single buffer of size (sizeof(message) + 3 * sizeof(uint8_t))
-  // flags, if none are passed, default to 0
-  static ssize_t send_move(int, message, std::array<uint8_t, 3>, int = 0);
-  game(int, int);
-  // this is the place where player messsages are processed
-  void play_game(int);
+  ssize_t send_move(int, message, std::array<uint8_t, 3>);
+  game(int, uint32_t, int, uint32_t);
   int get_other_player(int);
+  // 0 for m_players[0], 1 for m_players[1]
+  size_t player_index(int) const;
+  void return_to_lobby(int);
+  // expands the board just for the move, then packs it back
+  message check_move(coords, coords, promotion);
 
-  // this repeats a lot so it's its own function
-  // uses disconnect_player_and_close on both players, then closes the passed epoll_fd
-  void disconnect_both_players_and_poll(int);
   game() = delete;
   game(const game &) = delete;
   game(game &&) = delete;
   game &operator = (const game &) = delete;
   game &operator = (game &&) = delete;
-  ~game() = default;
 
+  std::mutex m_mutex;
   std::array<int, 2> m_players;
-  board m_board;
+  // of the players' connections when they were paired, indexed like m_players
+  std::array<uint32_t, 2> m_generations;
+  std::array<bool, 2> m_drop_next_frame = { false, false };
+  static std::chrono::steady_clock::duration base_time;
+  static std::chrono::steady_clock::duration increment;
+  // indexed like m_players, only the clock of the player whose turn it is runs, since m_turn_started
+  std::array<std::chrono::steady_clock::duration, 2> m_clocks;
+  std::chrono::steady_clock::time_point m_turn_started;
+  bool m_over = false;
+  // a player that joined, indexed like m_players
+  struct seat {
+    std::string username;
+    rating before;
+    std::optional<rating> after;
+  };
+  std::array<std::optional<seat>, 2> m_seats;
+  // m_players[0]'s score: 1 if it won, 0.5 for a draw and 0 if it lost
+  double m_score = 0;
+  // boards only get expanded while a move is being checked
+  packed_board m_board;
+  // the keys of the positions that can still repeat, the board copies them in and out around every move
+  std::vector<uint64_t> m_history;
+  std::vector<leaving_player> m_back_to_lobby;
 };
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "../../common/utils.h"
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include <atomic>
+#include <optional>
+
+// vyukov's multi producer single consumer queue
+// pushing is one exchange and one store, any thread can push, only the owning thread can pop
+template <typename T>
+class mpsc_queue {
+public:
+  mpsc_queue() : m_head(new node()), m_tail(m_head.load()) {}
+  ~mpsc_queue() {
+    while (m_tail != nullptr) {
+      node *next = m_tail->next.load();
+      delete m_tail;
+      m_tail = next;
+    }
+  }
+  mpsc_queue(const mpsc_queue &) = delete;
+  mpsc_queue &operator = (const mpsc_queue &) = delete;
+
+  void push(T value) {
+    node *n = new node();
+    n->value = std::move(value);
+    node *previous = m_head.exchange(n, std::memory_order_acq_rel);
+    previous->next.store(n, std::memory_order_release);
+  }
+  // can come back empty for a moment while a push is half done, the pusher's notify covers that
+  std::optional<T> pop() {
+    node *next = m_tail->next.load(std::memory_order_acquire);
+    if (next == nullptr) { return std::nullopt; }
+    delete m_tail;
+    m_tail = next;
+    return std::move(next->value);
+  }
+private:
+  struct node {
+    std::atomic<node *> next = nullptr;
+    T value;
+  };
+  // producers only touch the head, the consumer only touches the tail
+  // the tail is always a node whose value was already taken (or the stub it started with)
+  alignas(64) std::atomic<node *> m_head;
+  alignas(64) node *m_tail;
+};
+
+// mpsc_queue with an eventfd the owner can put in its epoll set
+// the eventfd is only written when the owner might be asleep, so a burst of pushes costs a single wakeup
+template <typename T>
+class handoff_queue {
+public:
+  handoff_queue() : m_fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), m_signalled(false) {
+    if (m_fd == -1) { error_print("handoff_queue eventfd"); }
+  }
+  ~handoff_queue() {
+    if (m_fd != -1 && close(m_fd) == -1) { error_print("handoff_queue close"); }
+  }
+  handoff_queue(const handoff_queue &) = delete;
+  handoff_queue &operator = (const handoff_queue &) = delete;
+
+  int fd() const { return m_fd; }
+  void push(T value) {
+    m_queue.push(std::move(value));
+    if (m_signalled.exchange(true) == false) {
+      uint64_t one = 1;
+      if (write(m_fd, &one, sizeof(one)) == -1) { error_print("handoff_queue eventfd write"); }
+    }
+  }
+  // has to be called by the owner when fd() becomes readable, f is called on everything that was pushed
+  // the flag is cleared before popping, anything pushed after that point either gets popped here or wakes the owner again
+  template <typename F>
+  void drain(F &&f) {
+    uint64_t count;
+    if (read(m_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) { error_print("handoff_queue eventfd read"); }
+    m_signalled.store(false);
+    while (std::optional<T> value = m_queue.pop()) { f(std::move(*value)); }
+  }
+private:
+  mpsc_queue<T> m_queue;
+  int m_fd;
+  std::atomic<bool> m_signalled;
+};
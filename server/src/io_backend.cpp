@@ -0,0 +1,37 @@
+#include "io_backend.h"
+
+#include "../../common/utils.h"
+#include "epoll_backend.h"
+#include "uring_backend.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+namespace {
+  thread_local io_backend *current_backend = nullptr;
+}
+
+std::unique_ptr<io_backend> io_backend::create(kind preferred) {
+  std::unique_ptr<io_backend> retval;
+  if (preferred == kind::uring) {
+    retval = uring_backend::create();
+    if (retval == nullptr) { fprintf(stderr, "io_uring is not usable on this kernel, falling back to epoll\n"); }
+  }
+  if (retval == nullptr) {
+    retval = epoll_backend::create();
+  }
+  current_backend = retval.get();
+  return retval;
+}
+ssize_t io_backend::recv_socket(int fd, void *buf, size_t len, int flags) {
+  if (current_backend != nullptr) { return current_backend->recv(fd, buf, len, flags); }
+  return ::recv(fd, buf, len, flags);
+}
+ssize_t io_backend::send_socket(int fd, const void *buf, size_t len, int flags) {
+  if (current_backend != nullptr) { return current_backend->send(fd, buf, len, flags); }
+  return ::send(fd, buf, len, flags | MSG_NOSIGNAL);
+}
+int io_backend::close_socket(int fd) {
+  if (current_backend != nullptr) { return current_backend->close(fd); }
+  return ::close(fd);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+
+#include <memory>
+#include <vector>
+
+// how a reactor waits for its sockets and moves bytes through them
+// events are handed back as epoll_events either way, so the reactors don't care which backend they got:
+//   EPOLLIN on a listening socket or an eventfd: accept or read has something
+//   EPOLLIN on a client socket: recv has something
+//   EPOLLERR / EPOLLRDHUP on a client socket: it's gone
+class io_backend {
+public:
+  enum class kind {
+    epoll,
+    uring,
+  };
+
+  // creates the backend the calling reactor thread will use and makes it the one recv_socket, send_socket and close_socket go through on it
+  // falls back to epoll if uring is asked for and the kernel can't do it
+  static std::unique_ptr<io_backend> create(kind);
+
+  // drop in replacements for recv, send and close on client sockets
+  // on a reactor thread they go through its backend, on any other thread they are the plain syscalls
+  // send never blocks: what the socket doesn't take right away is queued, and a socket with more than max_pending_output queued fails with ENOBUFS
+  static ssize_t recv_socket(int, void *, size_t, int = 0);
+  static ssize_t send_socket(int, const void *, size_t, int = 0);
+  static int close_socket(int);
+
+  // a client this far behind on reading what it's sent is cut off
+  static constexpr size_t max_pending_output = 64 * 1024;
+
+  virtual ~io_backend() = default;
+  virtual const char *name() const = 0;
+  virtual bool add_listener(int) = 0;
+  // eventfds, reported as long as they are readable
+  virtual bool add_wakeup(int) = 0;
+  // client sockets, watched until they are closed
+  virtual bool add(int) = 0;
+  // blocks until something happens, fills the vector (growing it if needed) and returns how many events there are
+  // there is never more than one event per socket
+  virtual int wait(std::vector<epoll_event> &) = 0;
+  // -1 with EAGAIN once there is nothing left to accept, accepted sockets are non blocking
+  virtual int accept(int) = 0;
+  virtual ssize_t recv(int, void *, size_t, int) = 0;
+  virtual ssize_t send(int, const void *, size_t, int) = 0;
+  // client and listening sockets, accepted sockets that weren't picked up yet are closed with their listener
+  virtual int close(int) = 0;
+};
@@ -8,6 +8,10 @@
 #include <stdlib.h>
 #include <sys/epoll.h>
 #include <signal.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <unordered_map>
 #include <vector>
@@ -15,24 +19,111 @@
 #include <thread>
 #include <iostream>
 #include <queue>
+#include <algorithm>
+#include <chrono>
 
 #include "../../common/utils.h"
 #include "user.h"
 #include "big_poll.h"
 #include "player_queue.h"
+#include "game.h"
+#include "io_backend.h"
+#include "bitboard.h"
 
 int get_bound_socket(const char *);
 
-int main(void) {
+// -l <count>: reactors (every socket lives in one of them, lobby, queue and games alike), defaults to one per core
+// -m <count>: matchmaking shards, each pairing the players of one rank band on its own thread, defaults to one per core
+// -b <epoll|uring>: io backend of the reactors, defaults to uring (which falls back to epoll if the kernel can't do it)
+// -q <length>: backlog of every listening socket, defaults to SOMAXCONN (the kernel caps it at net.core.somaxconn anyway)
+// -d <seconds>: how long SIGTERM waits for running games before closing everyone, defaults to 30
+// -c <base>[+<increment>]: time control of every game in seconds, a player whose clock runs out loses, defaults to 600+5 (0 for untimed games)
+// -i <seconds>: sockets that send nothing for this long in the lobby or the queue are closed, defaults to 300 (0 to never close them)
+// SIGTERM stops accepting and lets running games end, SIGINT (or a second SIGTERM) closes everyone right away
+int main(int argc, char **argv) {
+  size_t reactors = std::max(std::thread::hardware_concurrency(), 1U);
+  size_t matchers = reactors;
+  io_backend::kind backend_kind = io_backend::kind::uring;
+  int backlog = SOMAXCONN;
+  unsigned drain_seconds = 30;
+  unsigned long base_seconds = 600, increment_seconds = 5, idle_seconds = 300;
+  int opt;
+  while ((opt = getopt(argc, argv, "l:m:b:q:d:c:i:")) != -1) {
+    switch (opt) {
+      case 'i': idle_seconds = strtoul(optarg, NULL, 10); break;
+      case 'c': {
+        char *end;
+        base_seconds = strtoul(optarg, &end, 10);
+        increment_seconds = (*end == '+') ? strtoul(end + 1, NULL, 10) : 0;
+      } break;
+      case 'l': reactors = std::max(strtoul(optarg, NULL, 10), 1UL); break;
+      case 'm': matchers = std::max(strtoul(optarg, NULL, 10), 1UL); break;
+      case 'd': drain_seconds = static_cast<unsigned>(std::min(strtoul(optarg, NULL, 10), static_cast<unsigned long>(UINT32_MAX))); break;
+      case 'q': backlog = static_cast<int>(std::clamp(strtol(optarg, NULL, 10), 1L, static_cast<long>(INT32_MAX))); break;
+      case 'b':
+        if (strcmp(optarg, "epoll") == 0) { backend_kind = io_backend::kind::epoll; break; }
+        if (strcmp(optarg, "uring") == 0) { backend_kind = io_backend::kind::uring; break; }
+        [[fallthrough]];
+      default: fprintf(stderr, "usage: %s [-l reactors] [-m matchers] [-b epoll|uring] [-q backlog] [-d drain_seconds] [-c base[+increment]] [-i idle_seconds]\n", argv[0]); exit(EXIT_FAILURE);
+    }
+  }
+
+  //blocked before any thread starts so every thread inherits the mask, they only ever arrive through the signalfd
+  sigset_t shutdown_signals;
+  sigemptyset(&shutdown_signals);
+  sigaddset(&shutdown_signals, SIGTERM);
+  sigaddset(&shutdown_signals, SIGINT);
+  if (pthread_sigmask(SIG_BLOCK, &shutdown_signals, NULL) != 0) { error_print("pthread_sigmask"); exit(EXIT_FAILURE); }
+  int signal_fd = signalfd(-1, &shutdown_signals, SFD_CLOEXEC);
+  if (signal_fd == -1) { error_print("signalfd"); exit(EXIT_FAILURE); }
+
+  attacks::init();
   const char *port = "2048";
-  big_poll::set_listening_socket(get_bound_socket(port));
-  if (listen(big_poll::get_listening_socket(), 100) == -1) { error_print("listen"); exit(EXIT_FAILURE); }
-  std::thread big_poll_thread(big_poll::poll_users);
-  big_poll_thread.detach();
-  std::thread player_queue_poll_thread(player_queue::poll_users);
-  player_queue_poll_thread.detach();
-  std::thread player_queue_actual_queue_thread(player_queue::queue_work);
-  while (true) {}
+  //every reactor gets its own listening socket on the same port, the kernel balances connections between them
+  std::vector<int> listening_sockets;
+  for (size_t i = 0; i < reactors; i += 1) {
+    listening_sockets.push_back(get_bound_socket(port));
+    if (listen(listening_sockets.back(), backlog) == -1) { error_print("listen"); exit(EXIT_FAILURE); }
+  }
+  game::set_time_control(std::chrono::seconds(base_seconds), std::chrono::seconds(increment_seconds));
+  user::start_writer();
+  //the reactors can queue a player as soon as they start, so the shards have to be there before them
+  player_queue::start(matchers);
+  big_poll::start(listening_sockets, backend_kind, std::chrono::seconds(idle_seconds));
+
+  bool draining = false;
+  while (true) {
+    pollfd fds[2] = { { signal_fd, POLLIN, 0 }, { big_poll::stopped_fd(), POLLIN, 0 } };
+    if (poll(fds, 2, -1) == -1) {
+      if (errno != EINTR) { error_print("main poll"); }
+      continue;
+    }
+    if (fds[1].revents & POLLIN) { break; }
+    if ((fds[0].revents & POLLIN) == 0) { continue; }
+    signalfd_siginfo info;
+    if (read(signal_fd, &info, sizeof(info)) != sizeof(info)) {
+      error_print("signalfd read");
+      continue;
+    }
+    //nobody is paired once the server is going away, the reactors close whoever is still queued
+    if (draining == false) { player_queue::stop(); }
+    if (info.ssi_signo == SIGTERM && draining == false) {
+      fprintf(stderr, "SIGTERM, draining for up to %u seconds\n", drain_seconds);
+      draining = true;
+      big_poll::drain(drain_seconds);
+    } else {
+      fprintf(stderr, "%s, shutting down\n", info.ssi_signo == SIGTERM ? "second SIGTERM" : "SIGINT");
+      big_poll::shut_down();
+    }
+  }
+
+  big_poll::join();
+  player_queue::join();
+  //the games are all over, so no rating changes after this
+  user::stop_writer();
+  close(signal_fd);
+  fprintf(stderr, "server stopped\n");
+  return EXIT_SUCCESS;
 }
 
 int get_bound_socket(const char *port) {
@@ -59,7 +150,8 @@ int get_bound_socket(const char *port) {
   }
   int sfd;
   for (elem = addrinfos; elem != NULL; elem = elem->ai_next) {
-    sfd = socket(elem->ai_family, elem->ai_socktype, elem->ai_protocol);
+    //non blocking so the reactors can accept until the backlog is empty
+    sfd = socket(elem->ai_family, elem->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, elem->ai_protocol);
     if (sfd == -1) {
       continue;
     }
@@ -69,6 +161,18 @@ int get_bound_socket(const char *port) {
         close(sfd);
         exit(EXIT_FAILURE);
     }
+    if (setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == -1) {
+        error_print("Setsockopt failed");
+        close(sfd);
+        exit(EXIT_FAILURE);
+    }
+    //accepted sockets inherit it, so it's set once here instead of once per connection
+    int nodelay = 1;
+    if (setsockopt(sfd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay)) == -1) {
+        error_print("Setsockopt failed");
+        close(sfd);
+        exit(EXIT_FAILURE);
+    }
     if (bind(sfd, elem->ai_addr, elem->ai_addrlen) == 0) {
       break;
     }
@@ -0,0 +1,68 @@
+#include "output_queue.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+void output_queue::push(const void *data, size_t len) {
+  if (len == 0) { return; }
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  m_chunks.emplace_back(bytes, bytes + len);
+  m_size += len;
+}
+bool output_queue::flush(int fd) {
+  while (m_size != 0) {
+    iovec iov[max_iovecs];
+    size_t iov_count = 0;
+    for (auto it = m_chunks.begin(); it != m_chunks.end() && iov_count < max_iovecs; ++it) {
+      size_t offset = iov_count == 0 ? m_offset : 0;
+      iov[iov_count].iov_base = it->data() + offset;
+      iov[iov_count].iov_len = it->size() - offset;
+      iov_count += 1;
+    }
+    msghdr msg {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iov_count;
+    ssize_t sent = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent == -1) {
+      if (errno == EINTR) { continue; }
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    size_t written = static_cast<size_t>(sent);
+    m_size -= written;
+    while (written != 0) {
+      size_t left_in_chunk = m_chunks.front().size() - m_offset;
+      if (written < left_in_chunk) {
+        m_offset += written;
+        break;
+      }
+      written -= left_in_chunk;
+      m_chunks.pop_front();
+      m_offset = 0;
+    }
+    //the socket took less than it was given, it's full
+    if (m_size != 0 && iov_count < max_iovecs) { return true; }
+  }
+  return true;
+}
+bool output_queue::empty() const {
+  return m_size == 0;
+}
+size_t output_queue::size() const {
+  return m_size;
+}
+std::vector<uint8_t> output_queue::take() {
+  std::vector<uint8_t> retval;
+  retval.reserve(m_size);
+  for (const std::vector<uint8_t> &chunk : m_chunks) {
+    retval.insert(retval.end(), chunk.begin() + static_cast<ssize_t>(&chunk == &m_chunks.front() ? m_offset : 0), chunk.end());
+  }
+  clear();
+  return retval;
+}
+void output_queue::clear() {
+  m_chunks.clear();
+  m_offset = 0;
+  m_size = 0;
+}
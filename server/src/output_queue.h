@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <deque>
+#include <vector>
+
+// bytes waiting to go out on one socket, kept as the chunks they were sent in so they can be written with one call
+class output_queue {
+public:
+  void push(const void *, size_t);
+  // writes as much as the socket takes right now with a single sendmsg (writev with MSG_NOSIGNAL)
+  // returns false if the socket failed, errno is left as sendmsg set it
+  bool flush(int);
+  bool empty() const;
+  size_t size() const;
+  // everything that wasn't written yet, in one piece, and empties the queue
+  std::vector<uint8_t> take();
+  void clear();
+private:
+  // more than this many chunks are left for the next flush
+  static constexpr size_t max_iovecs = 64;
+
+  std::deque<std::vector<uint8_t>> m_chunks;
+  // bytes of the first chunk that were already written
+  size_t m_offset = 0;
+  size_t m_size = 0;
+};
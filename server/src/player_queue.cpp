@@ -1,195 +1,236 @@
 #include "player_queue.h"
 
 #include "../../common/utils.h"
-#include "big_poll.h"
 #include "game.h"
-#include <iostream>
-
-//
+#include "big_poll.h"
 
-//
+#include <poll.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
-int player_queue::epoll_fd;
-std::vector<epoll_event> player_queue::events;
-size_t player_queue::events_capacity = 100;
-size_t player_queue::events_size = 0;
-std::list<int> player_queue::queue;
-std::condition_variable player_queue::cond_var;
-std::mutex player_queue::mutex;
+#include <algorithm>
+#include <iterator>
 
-void player_queue::remove_sockets(size_t nfds) {
-  for (size_t i = 0; i < (size_t)nfds; i += 1) {
-    remove_socket(events[i].data.fd);
+std::vector<player_queue *> player_queue::shards;
+std::vector<std::thread> player_queue::threads;
+size_t player_queue::centre_shard = 0;
+std::atomic<bool> player_queue::stopped = false;
 
-    fprintf(stderr, "removed socket %lu %d\n", i, events[i].data.fd);
+player_queue::player_queue(size_t shard) : m_shard(shard) {
+  //signed, the bands below the centre can reach under 0 on paper
+  long long begin = static_cast<long long>(centre_rank) + (static_cast<long long>(shard) - static_cast<long long>(centre_shard)) * static_cast<long long>(band_width);
+  m_band_begin = static_cast<size_t>(std::max(begin, 0LL));
+  m_band_end = static_cast<size_t>(std::max(begin + static_cast<long long>(band_width), 0LL));
+}
+void player_queue::start(size_t shard_count) {
+  shard_count = std::max(shard_count, static_cast<size_t>(1));
+  centre_shard = shard_count / 2;
+  for (size_t i = 0; i < shard_count; i += 1) {
+    shards.push_back(new player_queue(i));
+  }
+  for (player_queue *shard : shards) {
+    threads.emplace_back(&player_queue::queue_work, shard);
   }
 }
-void player_queue::remove_socket(int fd) {
-  queue.remove(fd);
-
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1) { error_print("epoll_ctl player_queue remove client"); }
-
-  events_size -= 1;
+size_t player_queue::shard_of(size_t rank) {
+  long long offset = static_cast<long long>(rank) - static_cast<long long>(centre_rank);
+  long long band = offset >= 0 ? offset / static_cast<long long>(band_width) : -((-offset + static_cast<long long>(band_width) - 1) / static_cast<long long>(band_width));
+  long long retval = static_cast<long long>(centre_shard) + band;
+  return static_cast<size_t>(std::clamp(retval, 0LL, static_cast<long long>(shards.size()) - 1));
 }
-void player_queue::disconnect_socket(int fd) {
-  user::disconnectUser(fd);
-
-  if (close(fd) == -1) { error_print("player_queue close client"); }
+bool player_queue::add_socket(int to_add, uint32_t generation) {
+  //one that gets past this right as the queue stops is kept like the players that were already queued
+  if (stopped.load()) { return false; }
+  //the reactor is the only one that could log the user out, so it looks the rank up itself
+  size_t rank = user::get_rank_by_fd(to_add);
+  shards[shard_of(rank)]->m_requests.push({ request::type::add, to_add, generation, rank, clock::now() });
+  return true;
 }
-void player_queue::add_socket(int to_add) {
-  const std::lock_guard lock(mutex);
-
-  decltype(queue)::iterator it = queue.begin();
-  while (it != queue.end() && user::get_rank_by_fd(*it) < user::get_rank_by_fd(to_add)) { ++it; }
-  queue.insert(it, to_add);
-
-  epoll_event ev;
-  ev.events = EPOLLIN | EPOLLET;
-  ev.data.fd = to_add;
-
-  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, to_add, &ev) == -1) { error_print("epoll_ctl player_queue add client"); }
-
-  events_size += 1;
-  if (events_size >= events_capacity) {
-    events_capacity *= 2;
-    events.reserve(events_capacity);
+void player_queue::remove_socket(int to_remove, uint32_t generation) {
+  //the rank can't change while the player is queued, so it leads to the shard the player was added to
+  //that shard knows where it went from there
+  size_t rank = user::get_rank_by_fd(to_remove);
+  shards[shard_of(rank)]->m_requests.push({ request::type::remove, to_remove, generation, rank, {} });
+}
+void player_queue::stop() {
+  stopped.store(true);
+  for (player_queue *shard : shards) {
+    shard->m_requests.push({ request::type::stop, -1, 0, 0, {} });
   }
-  fprintf(stderr, "added new socket: %d\n", to_add);
-
-  cond_var.notify_one();
 }
-void player_queue::poll_users() {
-  epoll_fd = epoll_create1(0);
-  if (epoll_fd == -1) {
-    error_print("player_queue epoll_create");
+void player_queue::join() {
+  for (player_queue *shard : shards) {
+    shard->m_requests.push({ request::type::quit, -1, 0, 0, {} });
+  }
+  for (std::thread &shard_thread : threads) {
+    shard_thread.join();
+  }
+  threads.clear();
+}
+bool player_queue::handle_request(request &&r) {
+  switch (r.what) {
+    case request::type::add:
+    case request::type::hand_over:
+      insert(r.fd, r.generation, r.rank, r.queued_at);
+      if (r.what == request::type::add) { fprintf(stderr, "added new socket: %d\n", r.fd); }
+      break;
+    case request::type::remove: {
+      if (static_cast<size_t>(r.fd) >= m_handles.size()) { break; }
+      std::optional<handle> &h = m_handles[static_cast<size_t>(r.fd)];
+      //checked in case the player was paired, closed and its fd queued again since
+      if (h.has_value() == false || h->generation != r.generation) { break; }
+      if (h->it.has_value() == false) {
+        //requests from one shard to another arrive in the order they were pushed, so the player gets there before this does
+        shards[h->moved_to]->m_requests.push(std::move(r));
+        h.reset();
+        break;
+      }
+      take(*h->it);
+      fprintf(stderr, "removed socket %d\n", r.fd);
+      big_poll::left_queue(r.fd, r.generation);
+    } break;
+    case request::type::steal:
+      give_edge_player(r);
+      break;
+    case request::type::stop:
+      //the players stay, their reactors still get an answer when they leave
+      m_stopped = true;
+      break;
+    case request::type::quit:
+      return false;
+  }
+  return true;
+}
+void player_queue::insert(int fd, uint32_t generation, size_t rank, clock::time_point queued_at) {
+  if (static_cast<size_t>(fd) >= m_handles.size()) { m_handles.resize(static_cast<size_t>(fd) + 1); }
+  m_handles[static_cast<size_t>(fd)] = handle { generation, m_queue.insert({ rank, { fd, generation, queued_at, clock::now() } }), 0 };
+}
+player_queue::entry player_queue::take(index::iterator it) {
+  entry retval = it->second;
+  m_handles[static_cast<size_t>(retval.fd)].reset();
+  m_queue.erase(it);
+  return retval;
+}
+void player_queue::hand_over(index::iterator it, size_t to) {
+  entry player = it->second;
+  size_t rank = it->first;
+  m_queue.erase(it);
+  m_handles[static_cast<size_t>(player.fd)] = handle { player.generation, std::nullopt, to };
+  fprintf(stderr, "shard %zu handing socket %d (rank %zu) to shard %zu\n", m_shard, player.fd, rank, to);
+  shards[to]->m_requests.push({ request::type::hand_over, player.fd, player.generation, rank, player.queued_at });
+}
+void player_queue::hand_over_stragglers(clock::time_point now) {
+  if (m_queue.empty()) { return; }
+  //a shard that ran dry sends its last player towards the centre band, where everyone far apart meets in the end
+  //it waits two ticks, so both neighbours had one to steal the player or to answer its own steal
+  if (m_shard != centre_shard && m_queue.size() == 1 && now - m_queue.begin()->second.arrived_at >= 2 * tick) {
+    hand_over(m_queue.begin(), m_shard < centre_shard ? m_shard + 1 : m_shard - 1);
     return;
   }
-
-  events.reserve(events_capacity);
-
-  while (true) {
-    std::unique_lock lock(mutex);
-    // i DESPISE THE WAITS HERE but I have no idea how else to avoid deadlocks here
-    // this, as far as I know, is a fool-proof way of avoiding deadlocks
-    if (events_size == 0) {
-      lock.unlock();
-      usleep(500000);
-      continue;
-    }
-    int nfds;
-    while ((nfds = epoll_wait(epoll_fd, events.data(), events_size, 500)) == -1 && errno == EINTR) {}
-    if (nfds == -1) {
-      error_print("player_queue epoll_wait");
-      continue;
-    }
-    if (nfds == 0) {
-      lock.unlock();
-      cond_var.notify_one();
-      usleep(500000);
+  //only the edges, the players behind them are closer to someone in this band than to anyone past it
+  if (m_shard > 0 && m_queue.begin()->first < m_band_begin + window(m_queue.begin()->second, now)) {
+    steal_from(m_shard - 1, m_queue.begin());
+  }
+  if (m_shard + 1 < shards.size() && std::prev(m_queue.end())->first + window(std::prev(m_queue.end())->second, now) >= m_band_end) {
+    steal_from(m_shard + 1, std::prev(m_queue.end()));
+  }
+}
+void player_queue::steal_from(size_t from, index::iterator for_player) {
+  shards[from]->m_requests.push({ request::type::steal, for_player->second.fd, for_player->second.generation, for_player->first, for_player->second.queued_at, m_shard });
+}
+void player_queue::give_edge_player(const request &r) {
+  if (m_queue.empty()) { return; }
+  index::iterator edge = r.thief < m_shard ? m_queue.begin() : std::prev(m_queue.end());
+  clock::time_point now = clock::now();
+  entry theirs = { r.fd, r.generation, r.queued_at, now };
+  size_t gap = edge->first > r.rank ? edge->first - r.rank : r.rank - edge->first;
+  if (gap > std::min(window(edge->second, now), window(theirs, now))) { return; }
+  //two neighbours can ask for each other's edge player in the same tick, only the one that came in last moves (the one in the higher band on a tie)
+  bool ours_waited_longer = edge->second.queued_at < r.queued_at || (edge->second.queued_at == r.queued_at && m_shard < r.thief);
+  if (ours_waited_longer) { return; }
+  hand_over(edge, r.thief);
+}
+size_t player_queue::window(const entry &player, clock::time_point now) {
+  size_t waited_ms = static_cast<size_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now - player.queued_at).count());
+  return base_window + window_widening_per_second * waited_ms / 1000;
+}
+std::vector<player_queue::pairing> player_queue::sweep(clock::time_point now) {
+  std::vector<pairing> retval;
+  //the closest rank to a player's is always one of its neighbours in the index, so only neighbours are looked at
+  index::iterator it = m_queue.begin();
+  while (it != m_queue.end()) {
+    index::iterator next = std::next(it);
+    if (next == m_queue.end()) { break; }
+    size_t gap = next->first - it->first;
+    if (gap > std::min(window(it->second, now), window(next->second, now))) {
+      it = next;
       continue;
     }
-    fprintf(stderr, "no longer waiting, found %d readable sockets ready to remove\n", nfds);
-    remove_sockets((size_t)nfds);
-    lock.unlock();
-    for (size_t i = 0; i < (size_t)nfds; i += 1) {
-      if (events[i].events & (EPOLLPRI | EPOLLERR | EPOLLRDHUP | EPOLLHUP)) {
-        fprintf(stderr, "error on socket %lu %d, will disconnect the user and delete the file descriptor\n", i, events[i].data.fd);
-        disconnect_socket(events[i].data.fd);
-      } else if (events[i].events & EPOLLIN) {
-        fprintf(stderr, "reading the message from %lu %d\n", i, events[i].data.fd);
-        read_message(i);
-      }
-    }
+    index::iterator after = std::next(next);
+    size_t first_rank = it->first, second_rank = next->first;
+    retval.push_back({ take(it), take(next), first_rank, second_rank });
+    it = after;
   }
+  return retval;
 }
-void player_queue::queue_work() {
-  while (true) {
-    std::unique_lock lock(mutex);
-    //cond var woken up by adding an element or periodically by the poll if it's not processing anything
-    //I suspect that different queuing algorithms will have to use busy waits and/or usleep calls, may god help me then
-    cond_var.wait(lock, [] { return queue.size() >= 2; } );
-    int fd1 = queue.front();
-    remove_socket(queue.front());
-    int fd2 = queue.front();
-    remove_socket(queue.front());
-    lock.unlock();
-
-    message m1, m2;
-
-    ssize_t recv_ret1 = recv(fd1, &m1, sizeof(message), 0);
-    int errno1 = errno;
-    ssize_t recv_ret2 = recv(fd2, &m2, sizeof(message), 0);
-    int errno2 = errno;
-
-    //nothing to read on both but they're still connected
-    if (recv_ret1 == -1 && (errno1 == EWOULDBLOCK || errno1 == EAGAIN) && recv_ret2 == -1 && (errno2 == EWOULDBLOCK || errno2 == EAGAIN)) {
-      fprintf(stderr, "pairing up %d with %d\n", fd1, fd2);
-      std::thread new_game (game::start_game, fd1, fd2);
-      new_game.detach();
-    } else {
-      //can I rewrite this? sure
-      //will I? no
-      if (recv_ret1 == -1 && (errno1 == EWOULDBLOCK || errno1 == EAGAIN)) {
-        fprintf(stderr, "pushed socket %d back into the queue bcs partner %d dropped\n", fd1, fd2);
-        add_socket(fd1);
-      } else if (recv_ret1 == -1 && !(errno1 == EWOULDBLOCK || errno1 == EAGAIN)) {
-        user::recv_send_fail_handler(fd1, "player_queue first client message recv", errno1);
-      } else if (recv_ret1 == 0) {
-        disconnect_socket(fd1);
-      } else {
-        fprintf(stderr, "processing the message from %d\n", fd1);
-        process_message(fd1, m1);
-      }
-      if (recv_ret2 == -1 && (errno2 == EWOULDBLOCK || errno2 == EAGAIN)) {
-        fprintf(stderr, "pushed socket %d back into the queue bcs partner %d dropped\n", fd2, fd1);
-        add_socket(fd2);
-      } else if (recv_ret2 == -1 && !(errno2 == EWOULDBLOCK || errno2 == EAGAIN)) {
-        user::recv_send_fail_handler(fd1, "player_queue second client message recv", errno2);
-      } else if (recv_ret2 == 0) {
-        disconnect_socket(fd2);
-      } else {
-        fprintf(stderr, "processing the message from %d\n", fd2);
-        process_message(fd2, m2);
-      }
-    }
+void player_queue::start_games(const std::vector<pairing> &pairings, clock::time_point now) {
+  size_t total_gap = 0;
+  for (const pairing &p : pairings) {
+    size_t gap = p.second_rank - p.first_rank;
+    total_gap += gap;
+    fprintf(stderr, "pairing up %d (rank %zu, waited %lld ms) with %d (rank %zu, waited %lld ms), %zu apart\n",
+            p.first.fd, p.first_rank, static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(now - p.first.queued_at).count()),
+            p.second.fd, p.second_rank, static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(now - p.second.queued_at).count()), gap);
+    //a player that left since is found gone by its reactor, the game then plays it like a hangup
+    game::start_game(p.first.fd, p.first.generation, p.second.fd, p.second.generation);
   }
+  fprintf(stderr, "matchmaking tick of shard %zu paired %zu players, %.1f ranks apart on average\n", m_shard, pairings.size() * 2, static_cast<double>(total_gap) / static_cast<double>(pairings.size()));
 }
-void player_queue::read_message(size_t idx_to_read) {
-  message m;
-  ssize_t recv_retval = recv(events[idx_to_read].data.fd, &m, sizeof(message), 0);
-  if (recv_retval == -1 || recv_retval == 0) {
-    if (recv_retval == -1) { user::recv_send_fail_handler(events[idx_to_read].data.fd, "player_queue message recv"); }
-    else { disconnect_socket(events[idx_to_read].data.fd); }
+void player_queue::queue_work() {
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd == -1) {
+    error_print("player_queue timerfd");
     return;
   }
-  process_message(events[idx_to_read].data.fd, m);
-}
-void player_queue::process_message(int fd, message m) {
-  if (m == message::abort_match) {
-    big_poll::add_socket(fd);
-
-    message to_send = message::confirmation;
-    ssize_t send_retval = send(fd, &to_send, sizeof(message), 0);
-    if (send_retval == -1 || send_retval == 0) {
-      if (send_retval == -1) { user::recv_send_fail_handler(fd, "player_queue abort_search confirmation send"); }
-      else { disconnect_socket(fd); }
-      return;
+  bool ticking = false;
+  bool running = true;
+  while (running) {
+    pollfd fds[2] = { { m_requests.fd(), POLLIN, 0 }, { timer_fd, POLLIN, 0 } };
+    if (poll(fds, 2, -1) == -1) {
+      if (errno != EINTR) { error_print("player_queue poll"); }
+      continue;
+    }
+    if (fds[0].revents & POLLIN) {
+      m_requests.drain([this, &running](request &&r) { if (running) { running = handle_request(std::move(r)); } });
     }
-    fprintf(stderr, "aborted match search for socket %d\n", fd);
-  } else {
-    //if recieved_message is not valid, it means that the client is compromised and should be removed
-    std::cerr << "(command: " << get_message_as_text(m) << ") ";
-    fprintf(stderr, "disconnecting socket %d\n", fd);
-    if (m == message::quit) {
-      message to_send = message::confirmation;
-      ssize_t send_retval = send(fd, &to_send, sizeof(message), 0);
-    if (send_retval == -1 || send_retval == 0) {
-        if (send_retval == -1) { user::recv_send_fail_handler(fd, "player_queue quit confirmation send"); }
-        else { disconnect_socket(fd); }
-        return;
+    if (running == false) { break; }
+    clock::time_point now = clock::now();
+    if (fds[1].revents & POLLIN) {
+      uint64_t expirations;
+      if (read(timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) { error_print("player_queue timerfd read"); }
+      if (m_stopped == false) {
+        std::vector<pairing> pairings = sweep(now);
+        if (pairings.empty() == false) { start_games(pairings, now); }
+        //only whoever the sweep left over
+        hand_over_stragglers(now);
+      }
+    }
+
+    //players added between ticks wait for the next one, that's what batches them
+    //there's no tick while fewer than two players wait, so an empty shard sleeps until someone joins
+    //with other shards around it keeps ticking for a single player, so it can steal a partner from a neighbour or be handed over
+    bool should_tick = m_stopped == false && (m_queue.size() >= 2 || (m_queue.size() == 1 && shards.size() > 1));
+    if (should_tick != ticking) {
+      itimerspec spec = {};
+      if (should_tick) {
+        spec.it_value.tv_sec = static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(tick).count());
+        spec.it_value.tv_nsec = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(tick % std::chrono::seconds(1)).count());
+        spec.it_interval = spec.it_value;
       }
-      fprintf(stderr, "exited socket %d\n", fd);
+      if (timerfd_settime(timer_fd, 0, &spec, nullptr) == -1) { error_print("player_queue timerfd_settime"); }
+      ticking = should_tick;
     }
-    disconnect_socket(fd);
   }
+  if (close(timer_fd) == -1) { error_print("player_queue close timerfd"); }
 }
@@ -1,40 +1,140 @@
 #pragma once
 
 #include "user.h"
+#include "handoff_queue.h"
 
-#include "sys/epoll.h"
+#include <stdint.h>
 
-#include <queue>
-#include <condition_variable>
-#include <list>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <thread>
 #include <vector>
 
+// players waiting for a game, split into shards by rank band, each with its own index and matchmaking thread
+// their sockets stay in their big_poll reactors, the queue only holds their fd, connection generation and the rank they had when they joined
+// adding is O(log n), every fd has a handle to its entry so taking a player out is O(1)
+// a shard sweeps its index once per tick and pairs neighbours whose ranks are within both players' windows
+// a player's window widens the longer it waits, so everyone gets a game eventually
+// the index of a shard belongs to its thread, reactors only push requests to it, which wake it up through an eventfd
+// it ticks with a timerfd while there are two players to pair and sleeps otherwise
+// a player whose window reaches past its band asks the neighbour on that side for its edge player, the younger of the two moves
+// a player left alone in its shard is handed to the neighbouring shard towards the centre band, so far apart players meet there
 class player_queue {
 public:
-  static void add_socket(int);
+  // starts the passed number of shards, has to be called once before any reactor queues a player
+  static void start(size_t);
+  // these take the player's fd and connection generation, they are called by the player's reactor and return right away
+  // returns false once the shard's thread should return, the player isn't queued then
+  static bool add_socket(int, uint32_t);
+  // if the player is still in the queue it's taken out and its reactor gets big_poll::left_queue for it
+  // otherwise it was paired already and its game is on the way to the reactor
+  static void remove_socket(int, uint32_t);
+  // no game is started and no player is added after this, players still in the queue stay there
+  // removing them is still answered, until join
+  static void stop();
+  // stops the shard threads, no reactor can use the queue anymore by then
+  static void join();
 
-  static void poll_users();
-  static void queue_work();
-private:
-  player_queue() = delete;
   player_queue(const player_queue &) = delete;
   player_queue(player_queue &&) = delete;
   player_queue &operator = (const player_queue &) = delete;
   player_queue &operator = (player_queue &&) = delete;
   ~player_queue() = delete;
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct entry {
+    int fd;
+    uint32_t generation;
+    clock::time_point queued_at;
+    // when it came to this shard, a player another shard handed over keeps its queued_at but not this
+    clock::time_point arrived_at;
+  };
+  using index = std::multimap<size_t, entry>;
+  // where a fd that was added to the shard is now
+  struct handle {
+    uint32_t generation;
+    // nullopt once it was handed to another shard
+    std::optional<index::iterator> it;
+    size_t moved_to;
+  };
+  struct request {
+    enum class type : uint8_t {
+      add,
+      remove,
+      // a player another shard handed over, it keeps the time it joined the queue
+      hand_over,
+      // a neighbour's edge player could pair with the one passed, the edge player is handed to it if it's the younger one
+      steal,
+      stop,
+      quit,
+    };
+    type what;
+    int fd;
+    uint32_t generation;
+    size_t rank;
+    clock::time_point queued_at;
+    // the shard that asked, for steal
+    size_t thief = 0;
+  };
+  // two players the sweep paired, with their ranks
+  struct pairing {
+    entry first;
+    entry second;
+    size_t first_rank;
+    size_t second_rank;
+  };
+
+  static constexpr clock::duration tick = std::chrono::milliseconds(100);
+  // rank points, the window is how far the other player's rank can be
+  static constexpr size_t base_window = 50;
+  static constexpr size_t window_widening_per_second = 25;
+  // the centre band starts at the rank new accounts get, the ones below and above it are this wide, the outermost ones are open ended
+  static constexpr size_t centre_rank = 1000;
+  static constexpr size_t band_width = 100;
+
+  explicit player_queue(size_t);
+
+  static size_t shard_of(size_t);
+  static size_t window(const entry &, clock::time_point);
 
-  static void remove_sockets(size_t);
-  static void remove_socket(int);
-  static void disconnect_socket(int);
+  void queue_work();
+  // returns false once the shard's thread should return
+  bool handle_request(request &&);
+  void insert(int, uint32_t, size_t, clock::time_point);
+  // erases the entry and its handle
+  entry take(index::iterator);
+  // pairs everyone it can in one walk over the index
+  std::vector<pairing> sweep(clock::time_point);
+  // logs how far apart the players were and how long they waited, then starts the games
+  void start_games(const std::vector<pairing> &, clock::time_point);
+  // right after a sweep, for the players it left: hands the last one over towards the centre band if it went two ticks without a partner,
+  // otherwise asks the neighbours for a partner for every edge player whose window reaches past the band
+  void hand_over_stragglers(clock::time_point);
+  void hand_over(index::iterator, size_t);
+  // pushes a steal to the passed shard for the passed player
+  void steal_from(size_t, index::iterator);
+  // answers a steal, hands over the edge player facing the thief if it pairs with the thief's player and came in after it
+  void give_edge_player(const request &);
 
-  static void read_message(size_t);
-  static void process_message(int, message);
+  // never resized after start
+  static std::vector<player_queue *> shards;
+  static std::vector<std::thread> threads;
+  static size_t centre_shard;
+  static std::atomic<bool> stopped;
 
-  static int epoll_fd;
-  static std::vector<epoll_event> events;
-  static size_t events_capacity;
-  static size_t events_size;
-  static std::list<int> queue;
-  static std::condition_variable cond_var;
-  static std::mutex mutex;
+  size_t m_shard;
+  // the band is [m_band_begin, m_band_end), the outermost shards ignore the bound on their outer side
+  size_t m_band_begin;
+  size_t m_band_end;
+  handoff_queue<request> m_requests;
+  // nothing is paired or handed over once it's set, only the shard's thread touches it
+  bool m_stopped = false;
+  // only touched by the shard's thread
+  // a new entry goes after the ones with the same rank, so equal ranks are paired in the order they came in
+  index m_queue;
+  // indexed by fd, set while the fd is in the shard or was handed over from it
+  std::vector<std::optional<handle>> m_handles;
 };
@@ -0,0 +1,70 @@
+#include "rating.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+namespace {
+  // converts between the glicko scale and the glicko-2 one
+  constexpr double scale = 173.7178;
+  // how much the volatility can change, smaller values keep it steadier
+  constexpr double tau = 0.5;
+  constexpr double convergence_tolerance = 0.000001;
+
+  double g(double phi) {
+    return 1 / std::sqrt(1 + 3 * phi * phi / (std::numbers::pi * std::numbers::pi));
+  }
+}
+
+rating rating::after_game(const rating &opponent, double score) const {
+  //the glicko-2 scale is centred on 1500, only the difference between the two ratings matters so any centre works
+  double mu = (value - 1500) / scale, phi = deviation / scale;
+  double opponent_mu = (opponent.value - 1500) / scale, opponent_phi = opponent.deviation / scale;
+
+  double g_opponent = g(opponent_phi);
+  double expected = 1 / (1 + std::exp(-g_opponent * (mu - opponent_mu)));
+  double v = 1 / (g_opponent * g_opponent * expected * (1 - expected));
+  double delta = v * g_opponent * (score - expected);
+
+  //the new volatility is the root of f, found with the illinois algorithm like the paper does
+  double a = std::log(volatility * volatility);
+  auto f = [&](double x) {
+    double ex = std::exp(x);
+    double d = phi * phi + v + ex;
+    return ex * (delta * delta - phi * phi - v - ex) / (2 * d * d) - (x - a) / (tau * tau);
+  };
+  double A = a, B;
+  if (delta * delta > phi * phi + v) {
+    B = std::log(delta * delta - phi * phi - v);
+  } else {
+    double k = 1;
+    while (f(a - k * tau) < 0) { k += 1; }
+    B = a - k * tau;
+  }
+  double f_A = f(A), f_B = f(B);
+  while (std::abs(B - A) > convergence_tolerance) {
+    double C = A + (A - B) * f_A / (f_B - f_A);
+    double f_C = f(C);
+    if (f_C * f_B <= 0) {
+      A = B;
+      f_A = f_B;
+    } else {
+      f_A /= 2;
+    }
+    B = C;
+    f_B = f_C;
+  }
+  double new_volatility = std::exp(A / 2);
+
+  double phi_star = std::sqrt(phi * phi + new_volatility * new_volatility);
+  double new_phi = 1 / std::sqrt(1 / (phi_star * phi_star) + 1 / v);
+  double new_mu = mu + new_phi * new_phi * g_opponent * (score - expected);
+
+  rating retval;
+  //ranks are unsigned, a rating can't go under 0
+  retval.value = std::max(new_mu * scale + 1500, 0.0);
+  //a deviation never gets wider than a new account's
+  retval.deviation = std::min(new_phi * scale, initial_deviation);
+  retval.volatility = new_volatility;
+  return retval;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+// a player's glicko-2 rating (glickman, "example of the glicko-2 system")
+// every game is a rating period of its own, so a rating moves after each game instead of once per period
+struct rating {
+  // what new accounts start with
+  static constexpr double initial_value = 1000;
+  static constexpr double initial_deviation = 350;
+  static constexpr double initial_volatility = 0.06;
+
+  double value = initial_value;
+  double deviation = initial_deviation;
+  double volatility = initial_volatility;
+
+  // the rating after one game against the passed opponent, the score is 1 for a win, 0.5 for a draw and 0 for a loss
+  rating after_game(const rating &, double) const;
+  bool operator == (const rating &) const = default;
+};
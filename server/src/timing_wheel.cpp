@@ -0,0 +1,107 @@
+#include "timing_wheel.h"
+
+#include <algorithm>
+
+timing_wheel::timing_wheel(clock::duration tick) : m_start(clock::now()), m_tick(tick) {}
+uint64_t timing_wheel::ticks_before(clock::time_point when) const {
+  if (when <= m_start) { return 0; }
+  return static_cast<uint64_t>((when - m_start) / m_tick);
+}
+uint64_t timing_wheel::ticks_after(clock::time_point when) const {
+  if (when <= m_start) { return 0; }
+  clock::duration since_start = when - m_start;
+  return static_cast<uint64_t>((since_start + m_tick - clock::duration(1)) / m_tick);
+}
+void timing_wheel::arm(timer &t, clock::time_point when) {
+  if (t.m_armed) { unlink(t); }
+  link(t, ticks_after(when));
+}
+void timing_wheel::cancel(timer &t) {
+  if (t.m_armed) { unlink(t); }
+}
+void timing_wheel::link(timer &t, uint64_t expiry) {
+  //a tick that was handled already can't come up again, the next one is the soonest it can fire
+  expiry = std::max(expiry, m_now);
+  uint64_t delta = std::min<uint64_t>(expiry - m_now, (uint64_t(1) << (levels * level_bits)) - 1);
+  expiry = m_now + delta;
+  unsigned level = 0;
+  while (level + 1 < levels && delta >= (uint64_t(1) << ((level + 1) * level_bits))) { level += 1; }
+  unsigned slot = static_cast<unsigned>((expiry >> (level * level_bits)) & slot_mask);
+
+  t.m_expiry = expiry;
+  t.m_slot = static_cast<uint16_t>(level * slots_per_level + slot);
+  t.m_armed = true;
+  t.m_prev = nullptr;
+  t.m_next = m_slots[t.m_slot];
+  if (t.m_next != nullptr) { t.m_next->m_prev = &t; }
+  m_slots[t.m_slot] = &t;
+  m_used[level][slot / 64] |= uint64_t(1) << (slot % 64);
+}
+void timing_wheel::unlink(timer &t) {
+  if (t.m_prev != nullptr) {
+    t.m_prev->m_next = t.m_next;
+  } else {
+    m_slots[t.m_slot] = t.m_next;
+  }
+  if (t.m_next != nullptr) { t.m_next->m_prev = t.m_prev; }
+  if (m_slots[t.m_slot] == nullptr && t.m_slot != expiring) {
+    unsigned level = t.m_slot / slots_per_level, slot = t.m_slot % slots_per_level;
+    m_used[level][slot / 64] &= ~(uint64_t(1) << (slot % 64));
+  }
+  t.m_prev = nullptr;
+  t.m_next = nullptr;
+  t.m_armed = false;
+}
+void timing_wheel::cascade(uint64_t tick) {
+  //a level's slots only come up when every level below it starts over, the highest one goes first so nothing lands in a slot that's about to be emptied
+  unsigned top = 0;
+  while (top + 1 < levels && (tick & ((uint64_t(1) << ((top + 1) * level_bits)) - 1)) == 0) { top += 1; }
+  for (unsigned level = top; level > 0; level -= 1) {
+    size_t index = level * slots_per_level + ((tick >> (level * level_bits)) & slot_mask);
+    while (timer *t = m_slots[index]) {
+      unlink(*t);
+      link(*t, t->m_expiry);
+    }
+  }
+}
+void timing_wheel::take_expired(uint64_t tick) {
+  size_t index = tick & slot_mask;
+  m_slots[expiring] = m_slots[index];
+  m_slots[index] = nullptr;
+  m_used[0][index / 64] &= ~(uint64_t(1) << (index % 64));
+  for (timer *t = m_slots[expiring]; t != nullptr; t = t->m_next) { t->m_slot = static_cast<uint16_t>(expiring); }
+}
+int timing_wheel::next_slot(unsigned level, unsigned from) const {
+  const std::array<uint64_t, slots_per_level / 64> &used = m_used[level];
+  //the first word is looked at twice, from the passed slot on and then (after wrapping around) up to it
+  for (unsigned i = 0; i <= used.size(); i += 1) {
+    unsigned word = (from / 64 + i) % used.size();
+    uint64_t bits = used[word];
+    if (i == 0) { bits &= ~uint64_t(0) << (from % 64); }
+    if (i == used.size()) { bits &= (uint64_t(1) << (from % 64)) - 1; }
+    if (bits != 0) { return static_cast<int>(word * 64 + static_cast<unsigned>(__builtin_ctzll(bits))); }
+  }
+  return -1;
+}
+std::optional<uint64_t> timing_wheel::next_tick() const {
+  std::optional<uint64_t> retval;
+  for (unsigned level = 0; level < levels; level += 1) {
+    unsigned shift = level * level_bits;
+    unsigned current = static_cast<unsigned>((m_now >> shift) & slot_mask);
+    //the current slot of a higher level only still has to come up if the level hasn't moved past its start yet
+    //otherwise a timer in it is a whole turn of the level away
+    bool at_slot_start = level == 0 || (m_now & ((uint64_t(1) << shift) - 1)) == 0;
+    int slot = next_slot(level, at_slot_start ? current : (current + 1) & slot_mask);
+    if (slot == -1) { continue; }
+    uint64_t distance = (static_cast<unsigned>(slot) - current) & slot_mask;
+    if (distance == 0 && at_slot_start == false) { distance = slots_per_level; }
+    uint64_t tick = level == 0 ? m_now + distance : ((m_now >> shift) + distance) << shift;
+    if (retval.has_value() == false || tick < *retval) { retval = tick; }
+  }
+  return retval;
+}
+std::optional<timing_wheel::clock::time_point> timing_wheel::next_expiry() const {
+  std::optional<uint64_t> tick = next_tick();
+  if (tick.has_value() == false) { return std::nullopt; }
+  return m_start + m_tick * static_cast<clock::rep>(*tick);
+}
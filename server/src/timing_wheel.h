@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+#include <chrono>
+#include <optional>
+
+// hierarchical timing wheel: 4 levels of 256 slots, a level 0 slot is one tick and a level n slot is 256^n ticks
+// timers are intrusive lists, so arming and cancelling one is O(1) and never allocates
+// a timer sits in the lowest level its expiry fits in and moves down a level when its slot comes up
+// there's a bitmap of the slots in use per level, so finding the next expiry never walks empty slots
+// not thread safe, every reactor has its own
+class timing_wheel {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // lives in whatever is being timed, the wheel only links it into its slots
+  class timer {
+  public:
+    // the wheel doesn't look at it, it's there for whoever handles the expiry
+    int fd = -1;
+    bool armed() const { return m_armed; }
+  private:
+    friend class timing_wheel;
+    timer *m_prev = nullptr;
+    timer *m_next = nullptr;
+    uint64_t m_expiry = 0;
+    uint16_t m_slot = 0;
+    bool m_armed = false;
+  };
+
+  explicit timing_wheel(clock::duration);
+  timing_wheel(const timing_wheel &) = delete;
+  timing_wheel &operator = (const timing_wheel &) = delete;
+
+  // moves the timer if it was armed already
+  // it never fires before the passed time but can fire up to a tick after it, timers further than 256^4 ticks away fire early
+  void arm(timer &, clock::time_point);
+  void cancel(timer &);
+  // when the next timer expires, nullopt if none is armed
+  std::optional<clock::time_point> next_expiry() const;
+  // disarms every timer that expired by the passed time and calls f with it, f can arm and cancel any timer
+  template <typename F>
+  void advance(clock::time_point now, F &&f) {
+    uint64_t target = ticks_before(now);
+    while (std::optional<uint64_t> next = next_tick()) {
+      if (*next > target) { break; }
+      uint64_t tick = *next;
+      m_now = tick;
+      cascade(tick);
+      take_expired(tick);
+      m_now = tick + 1;
+      while (timer *expired = m_slots[expiring]) {
+        unlink(*expired);
+        f(*expired);
+      }
+    }
+    if (target >= m_now) { m_now = target + 1; }
+  }
+private:
+  static constexpr unsigned levels = 4;
+  static constexpr unsigned level_bits = 8;
+  static constexpr unsigned slots_per_level = 1 << level_bits;
+  static constexpr uint64_t slot_mask = slots_per_level - 1;
+  // where the timers of the tick being handled wait for f, f can arm a timer into the slot they came from
+  static constexpr size_t expiring = levels * slots_per_level;
+
+  uint64_t ticks_before(clock::time_point) const;
+  uint64_t ticks_after(clock::time_point) const;
+  void link(timer &, uint64_t);
+  void unlink(timer &);
+  // moves the timers of every higher level slot that comes up at the tick (which has to be m_now) down to lower levels
+  void cascade(uint64_t);
+  // moves the level 0 slot of the tick to expiring
+  void take_expired(uint64_t);
+  // the first tick something has to be done at, an expiry or a cascade
+  std::optional<uint64_t> next_tick() const;
+  // the first slot in use at or after the passed one, wrapping around, -1 if there is none
+  int next_slot(unsigned, unsigned) const;
+
+  clock::time_point m_start;
+  clock::duration m_tick;
+  // the first tick that wasn't handled yet
+  uint64_t m_now = 0;
+  std::array<timer *, levels * slots_per_level + 1> m_slots = {};
+  std::array<std::array<uint64_t, slots_per_level / 64>, levels> m_used = {};
+};
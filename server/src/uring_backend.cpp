@@ -0,0 +1,475 @@
+#include "uring_backend.h"
+
+#include "../../common/utils.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+
+namespace {
+  int io_uring_setup(unsigned entries, io_uring_params *params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+  }
+  int io_uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0));
+  }
+  int io_uring_register(int ring_fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return static_cast<int>(syscall(__NR_io_uring_register, ring_fd, opcode, arg, nr_args));
+  }
+
+  // user_data: operation (8 bits), generation (24 bits), fd (32 bits)
+  uint64_t make_user_data(uint8_t op, uint32_t generation, int fd) {
+    return static_cast<uint64_t>(op) << 56 | static_cast<uint64_t>(generation & 0xFFFFFF) << 32 | static_cast<uint32_t>(fd);
+  }
+}
+
+std::unique_ptr<io_backend> uring_backend::create() {
+  std::unique_ptr<uring_backend> retval(new uring_backend());
+  if (retval->setup() == false) { return nullptr; }
+  return retval;
+}
+bool uring_backend::setup() {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  //SINGLE_ISSUER came in 6.0 together with multishot recv, so a kernel that accepts it can do everything used here
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_CQSIZE;
+  params.cq_entries = ring_entries * 4;
+  m_ring_fd = io_uring_setup(ring_entries, &params);
+  if (m_ring_fd == -1) {
+    error_print("uring_backend io_uring_setup");
+    return false;
+  }
+  if ((params.features & IORING_FEAT_NODROP) == 0) {
+    fprintf(stderr, "uring_backend: the kernel can drop completions\n");
+    return false;
+  }
+
+  m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+  }
+  m_sq_ring = mmap(NULL, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING);
+  if (m_sq_ring == MAP_FAILED) {
+    m_sq_ring = nullptr;
+    error_print("uring_backend sq ring mmap");
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    m_cq_ring = m_sq_ring;
+  } else {
+    m_cq_ring = mmap(NULL, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING);
+    if (m_cq_ring == MAP_FAILED) {
+      m_cq_ring = nullptr;
+      error_print("uring_backend cq ring mmap");
+      return false;
+    }
+  }
+  m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  m_sqes = static_cast<io_uring_sqe *>(mmap(NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES));
+  if (m_sqes == MAP_FAILED) {
+    m_sqes = nullptr;
+    error_print("uring_backend sqes mmap");
+    return false;
+  }
+
+  uint8_t *sq = static_cast<uint8_t *>(m_sq_ring);
+  m_sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+  m_sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  m_sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  m_sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  m_sq_entries = params.sq_entries;
+  m_sq_local_tail = *m_sq_tail;
+  uint8_t *cq = static_cast<uint8_t *>(m_cq_ring);
+  m_cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  m_cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  m_cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  //the buffer ring and the buffers it hands out, every buffer is given back as soon as its bytes are copied out
+  m_buf_ring_size = buffer_count * sizeof(io_uring_buf);
+  void *buf_ring = mmap(NULL, m_buf_ring_size + buffer_count * buffer_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf_ring == MAP_FAILED) {
+    error_print("uring_backend buffer ring mmap");
+    return false;
+  }
+  m_buf_ring = static_cast<io_uring_buf_ring *>(buf_ring);
+  m_buffers = static_cast<uint8_t *>(buf_ring) + m_buf_ring_size;
+  io_uring_buf_reg reg;
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = reinterpret_cast<uint64_t>(m_buf_ring);
+  reg.ring_entries = buffer_count;
+  reg.bgid = buffer_group;
+  if (io_uring_register(m_ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    error_print("uring_backend register buffer ring");
+    return false;
+  }
+  for (uint16_t bid = 0; bid < buffer_count; bid += 1) {
+    recycle_buffer(bid);
+  }
+  return true;
+}
+uring_backend::~uring_backend() {
+  if (m_buf_ring != nullptr && munmap(m_buf_ring, m_buf_ring_size + buffer_count * buffer_size) == -1) { error_print("uring_backend buffer ring munmap"); }
+  if (m_sqes != nullptr && munmap(m_sqes, m_sqes_size) == -1) { error_print("uring_backend sqes munmap"); }
+  if (m_cq_ring != nullptr && m_cq_ring != m_sq_ring && munmap(m_cq_ring, m_cq_ring_size) == -1) { error_print("uring_backend cq ring munmap"); }
+  if (m_sq_ring != nullptr && munmap(m_sq_ring, m_sq_ring_size) == -1) { error_print("uring_backend sq ring munmap"); }
+  if (m_ring_fd != -1 && ::close(m_ring_fd) == -1) { error_print("uring_backend close"); }
+}
+const char *uring_backend::name() const {
+  return "io_uring";
+}
+uring_backend::socket_state &uring_backend::state(int fd) {
+  size_t idx = static_cast<size_t>(fd);
+  if (idx >= m_sockets.size()) {
+    m_sockets.resize(std::max(idx + 1, m_sockets.size() * 2));
+  }
+  if (m_sockets[idx] == nullptr) {
+    m_sockets[idx] = std::make_unique<socket_state>();
+  }
+  return *m_sockets[idx];
+}
+uring_backend::socket_state *uring_backend::find(int fd) {
+  size_t idx = static_cast<size_t>(fd);
+  return idx < m_sockets.size() ? m_sockets[idx].get() : nullptr;
+}
+io_uring_sqe *uring_backend::get_sqe() {
+  //the kernel takes every prepared entry on each enter, so a full ring only needs one
+  if (m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) == m_sq_entries) { enter(false); }
+  unsigned idx = m_sq_local_tail & m_sq_mask;
+  io_uring_sqe *sqe = &m_sqes[idx];
+  memset(sqe, 0, sizeof(io_uring_sqe));
+  m_sq_array[idx] = idx;
+  m_sq_local_tail += 1;
+  return sqe;
+}
+void uring_backend::prepare(io_uring_sqe *sqe, operation op, int fd, const socket_state &s) {
+  sqe->fd = fd;
+  sqe->user_data = make_user_data(static_cast<uint8_t>(op), s.generation, fd);
+}
+void uring_backend::arm_accept(int fd) {
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  socket_state &s = state(fd);
+  prepare(sqe, operation::accept, fd, s);
+  s.accept_armed = true;
+}
+void uring_backend::arm_wakeup(int fd) {
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->len = IORING_POLL_ADD_MULTI;
+  sqe->poll32_events = POLLIN;
+  prepare(sqe, operation::wakeup, fd, state(fd));
+}
+void uring_backend::arm_recv(int fd) {
+  socket_state &s = state(fd);
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = buffer_group;
+  prepare(sqe, operation::recv, fd, s);
+  s.recv_armed = true;
+}
+void uring_backend::cancel_all(int fd) {
+  io_uring_sqe *sqe = get_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  prepare(sqe, operation::cancel, fd, state(fd));
+}
+void uring_backend::recycle_buffer(uint16_t bid) {
+  //not m_buf_ring->bufs, in C++ the header's flexible array member comes after a padded empty struct and lands 8 bytes too far
+  io_uring_buf &buf = reinterpret_cast<io_uring_buf *>(m_buf_ring)[m_buf_tail & (buffer_count - 1)];
+  buf.addr = reinterpret_cast<uint64_t>(m_buffers + static_cast<size_t>(bid) * buffer_size);
+  buf.len = buffer_size;
+  buf.bid = bid;
+  m_buf_tail += 1;
+  __atomic_store_n(&m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE);
+}
+void uring_backend::queue_ready(int fd) {
+  socket_state &s = state(fd);
+  if (s.ready_queued) { return; }
+  s.ready_queued = true;
+  m_ready.push_back(fd);
+}
+void uring_backend::queue_output(int fd) {
+  socket_state &s = state(fd);
+  if (s.output_queued) { return; }
+  s.output_queued = true;
+  m_pending_output.push_back(fd);
+}
+bool uring_backend::enter(bool wait_for_completion) {
+  __atomic_store_n(m_sq_tail, m_sq_local_tail, __ATOMIC_RELEASE);
+  while (true) {
+    unsigned to_submit = m_sq_local_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+    //GETEVENTS is always passed, with DEFER_TASKRUN completions are only posted while in here
+    if (io_uring_enter(m_ring_fd, to_submit, wait_for_completion ? 1 : 0, IORING_ENTER_GETEVENTS) != -1) { return true; }
+    if (errno == EINTR) { continue; }
+    //the completion ring is full, make room and go again
+    if (errno == EBUSY || errno == EAGAIN) {
+      reap();
+      wait_for_completion = false;
+      continue;
+    }
+    error_print("uring_backend io_uring_enter");
+    return false;
+  }
+}
+void uring_backend::reap() {
+  unsigned head = *m_cq_head;
+  while (head != __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE)) {
+    io_uring_cqe cqe = m_cqes[head & m_cq_mask];
+    head += 1;
+    __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    handle(cqe);
+  }
+}
+void uring_backend::handle(const io_uring_cqe &cqe) {
+  operation op = static_cast<operation>(cqe.user_data >> 56);
+  uint32_t generation = static_cast<uint32_t>(cqe.user_data >> 32) & 0xFFFFFF;
+  int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+  bool more = cqe.flags & IORING_CQE_F_MORE;
+  socket_state &s = state(fd);
+  bool current = generation == (s.generation & 0xFFFFFF);
+
+  switch (op) {
+    case operation::accept:
+      if (current && more == false) { s.accept_armed = false; }
+      //the listener is being closed, anything its cancelled accept still let through goes too
+      if (current == false || s.kind != role::listener) {
+        if (cqe.res >= 0) { ::close(cqe.res); }
+        break;
+      }
+      if (cqe.res >= 0) {
+        s.accepted.push_back(cqe.res);
+        queue_ready(fd);
+      } else {
+        error_print("uring_backend accept", -cqe.res);
+      }
+      if (more == false) { arm_accept(fd); }
+      break;
+    case operation::wakeup:
+      queue_ready(fd);
+      if (more == false) { arm_wakeup(fd); }
+      break;
+    case operation::recv:
+      if (cqe.flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        if (current && cqe.res > 0) {
+          const uint8_t *data = m_buffers + static_cast<size_t>(bid) * buffer_size;
+          s.input.insert(s.input.end(), data, data + cqe.res);
+          queue_ready(fd);
+        }
+        recycle_buffer(bid);
+      }
+      if (current == false || more) { break; }
+      s.recv_armed = false;
+      if (cqe.res == 0) {
+        s.eof = true;
+        queue_ready(fd);
+      } else if (cqe.res == -ECANCELED) {
+        //closed, whoever cancelled it is waiting for this
+      } else if (cqe.res < 0 && cqe.res != -ENOBUFS) {
+        s.error = -cqe.res;
+        queue_ready(fd);
+      } else if (s.kind == role::client) {
+        //ran out of buffers, or the kernel just stopped the multishot, either way the socket is still there
+        arm_recv(fd);
+      }
+      break;
+    case operation::send:
+      if (current == false) { break; }
+      s.send_in_flight = false;
+      if (cqe.res < 0 && cqe.res != -ECANCELED) {
+        s.error = -cqe.res;
+        queue_ready(fd);
+      } else if (cqe.res > 0) {
+        s.in_flight.erase(s.in_flight.begin(), s.in_flight.begin() + cqe.res);
+      }
+      //whatever didn't go out (a short or cancelled send) goes back in front of anything queued in the meantime
+      s.in_flight.insert(s.in_flight.end(), s.output.begin(), s.output.end());
+      std::swap(s.in_flight, s.output);
+      s.in_flight.clear();
+      if (s.output.empty() == false && s.error == 0) { queue_output(fd); }
+      break;
+    case operation::cancel:
+      break;
+  }
+}
+void uring_backend::submit_output() {
+  for (int fd : m_pending_output) {
+    socket_state &s = state(fd);
+    s.output_queued = false;
+    if (s.send_in_flight || s.output.empty() || s.error != 0) { continue; }
+    std::swap(s.output, s.in_flight);
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->addr = reinterpret_cast<uint64_t>(s.in_flight.data());
+    sqe->len = static_cast<uint32_t>(s.in_flight.size());
+    sqe->msg_flags = MSG_NOSIGNAL;
+    prepare(sqe, operation::send, fd, s);
+    s.send_in_flight = true;
+  }
+  m_pending_output.clear();
+}
+void uring_backend::quiesce(int fd) {
+  socket_state &s = state(fd);
+  //a recv that ran out of buffers gets armed again while this waits, so the cancel is sent every time around
+  //it always completes, so waiting for a completion never hangs
+  while (s.recv_armed || s.send_in_flight || s.accept_armed) {
+    cancel_all(fd);
+    if (enter(true) == false) { break; }
+    reap();
+  }
+}
+void uring_backend::send_leftover_output(int fd) {
+  socket_state &s = state(fd);
+  if (s.output.empty() == false && s.error == 0) {
+    ::send(fd, s.output.data(), s.output.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  }
+}
+bool uring_backend::add_listener(int fd) {
+  socket_state &s = state(fd);
+  s.kind = role::listener;
+  m_listeners.push_back(fd);
+  arm_accept(fd);
+  return true;
+}
+bool uring_backend::add_wakeup(int fd) {
+  state(fd).kind = role::wakeup;
+  arm_wakeup(fd);
+  return true;
+}
+bool uring_backend::add(int fd) {
+  socket_state &s = state(fd);
+  s.generation += 1;
+  s.kind = role::client;
+  s.eof = false;
+  s.error = 0;
+  s.input.clear();
+  s.input_begin = 0;
+  arm_recv(fd);
+  return true;
+}
+int uring_backend::close(int fd) {
+  socket_state *s = find(fd);
+  if (s != nullptr && s->kind == role::listener) {
+    //an armed accept keeps the socket listening after it's closed, so the cancel is waited for
+    s->kind = role::none;
+    quiesce(fd);
+    for (int accepted : s->accepted) { ::close(accepted); }
+    s->accepted.clear();
+    std::erase(m_listeners, fd);
+    s->generation += 1;
+  }
+  if (s != nullptr && s->kind == role::client) {
+    quiesce(fd);
+    //last words (a quit confirmation) are sent if the socket takes them right away
+    send_leftover_output(fd);
+    s->output.clear();
+    s->input.clear();
+    s->input_begin = 0;
+    s->kind = role::none;
+    s->generation += 1;
+  }
+  return ::close(fd);
+}
+int uring_backend::wait(std::vector<epoll_event> &events) {
+  int nfds = 0;
+  //completions of sends and cancels don't make events, so this can take a few rounds
+  while (nfds == 0) {
+    //accepted sockets that weren't picked up in the last round
+    for (int fd : m_listeners) {
+      if (state(fd).accepted.empty() == false) { queue_ready(fd); }
+    }
+    submit_output();
+    //only block if there is nothing to report yet
+    if (enter(m_ready.empty()) == false) { return -1; }
+    reap();
+
+    std::vector<int> ready;
+    std::swap(ready, m_ready);
+    for (int fd : ready) {
+      socket_state &s = state(fd);
+      s.ready_queued = false;
+      uint32_t flags = 0;
+      if (s.kind == role::listener) {
+        if (s.accepted.empty() == false) { flags = EPOLLIN; }
+      } else if (s.kind == role::wakeup) {
+        flags = EPOLLIN;
+      } else if (s.kind == role::client) {
+        if (s.input.size() > s.input_begin) {
+          flags = EPOLLIN;
+          //the end of the stream is reported on its own once the input is read
+          if (s.eof || s.error != 0) { queue_ready(fd); }
+        } else if (s.error != 0) {
+          flags = EPOLLERR;
+        } else if (s.eof) {
+          flags = EPOLLIN | EPOLLRDHUP;
+        }
+      }
+      if (flags == 0) { continue; }
+      if (static_cast<size_t>(nfds) == events.size()) { events.resize(std::max<size_t>(events.size() * 2, 16)); }
+      events[nfds].events = flags;
+      events[nfds].data.fd = fd;
+      nfds += 1;
+    }
+  }
+  return nfds;
+}
+int uring_backend::accept(int listening_socket) {
+  socket_state &s = state(listening_socket);
+  if (s.accepted.empty()) {
+    errno = EAGAIN;
+    return -1;
+  }
+  int retval = s.accepted.front();
+  s.accepted.pop_front();
+  return retval;
+}
+ssize_t uring_backend::recv(int fd, void *buf, size_t len, int flags) {
+  socket_state *s = find(fd);
+  if (s == nullptr || s->kind != role::client) { return ::recv(fd, buf, len, flags); }
+  size_t available = s->input.size() - s->input_begin;
+  if (available > 0) {
+    size_t retval = std::min(len, available);
+    memcpy(buf, s->input.data() + s->input_begin, retval);
+    s->input_begin += retval;
+    if (s->input_begin == s->input.size()) {
+      s->input.clear();
+      s->input_begin = 0;
+    }
+    return static_cast<ssize_t>(retval);
+  }
+  if (s->error != 0) {
+    errno = s->error;
+    return -1;
+  }
+  if (s->eof) { return 0; }
+  errno = EAGAIN;
+  return -1;
+}
+ssize_t uring_backend::send(int fd, const void *buf, size_t len, int flags) {
+  socket_state *s = find(fd);
+  //sockets the ring doesn't own could be closed and reused by their owner before a queued send goes out
+  if (s == nullptr || s->kind != role::client) { return ::send(fd, buf, len, flags | MSG_NOSIGNAL); }
+  if (s->error != 0) {
+    errno = s->error;
+    return -1;
+  }
+  if (s->output.size() + s->in_flight.size() + len > max_pending_output) {
+    errno = ENOBUFS;
+    return -1;
+  }
+  const uint8_t *data = static_cast<const uint8_t *>(buf);
+  s->output.insert(s->output.end(), data, data + len);
+  queue_output(fd);
+  return static_cast<ssize_t>(len);
+}
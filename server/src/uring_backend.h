@@ -0,0 +1,123 @@
+#pragma once
+
+#include "io_backend.h"
+
+#include <linux/io_uring.h>
+
+#include <deque>
+
+// completion based, one ring per reactor thread
+// listening sockets get a multishot accept, client sockets a multishot recv that fills buffers from a provided buffer ring,
+// and replies are queued per socket and only submitted, all together, when the reactor goes back to waiting
+// the ring is set up with SINGLE_ISSUER, so create only works on kernels that also have multishot recv (6.0 and later)
+class uring_backend : public io_backend {
+public:
+  static std::unique_ptr<io_backend> create();
+  ~uring_backend() override;
+
+  const char *name() const override;
+  bool add_listener(int) override;
+  bool add_wakeup(int) override;
+  bool add(int) override;
+  int wait(std::vector<epoll_event> &) override;
+  int accept(int) override;
+  ssize_t recv(int, void *, size_t, int) override;
+  ssize_t send(int, const void *, size_t, int) override;
+  int close(int) override;
+private:
+  // what a submission was for, kept in the top byte of its user_data
+  enum class operation : uint8_t {
+    accept,
+    wakeup,
+    recv,
+    send,
+    cancel,
+  };
+  enum class role : uint8_t {
+    none,
+    listener,
+    wakeup,
+    client,
+  };
+  struct socket_state {
+    role kind = role::none;
+    // bumped every time the socket is added or closed, completions for an older generation are dropped
+    uint32_t generation = 0;
+    bool recv_armed = false;
+    bool accept_armed = false;
+    bool send_in_flight = false;
+    bool eof = false;
+    // waiting in m_ready / m_pending_output
+    bool ready_queued = false;
+    bool output_queued = false;
+    int error = 0;
+    // received but not read yet, starting at input_begin
+    std::vector<uint8_t> input;
+    size_t input_begin = 0;
+    // queued by send, then moved to in_flight while the kernel sends it (and left alone until it's done)
+    std::vector<uint8_t> output;
+    std::vector<uint8_t> in_flight;
+    // accepted sockets not picked up yet, listeners only
+    std::deque<int> accepted;
+  };
+
+  static constexpr unsigned ring_entries = 1024;
+  static constexpr unsigned buffer_count = 512;
+  static constexpr unsigned buffer_size = 1024;
+  static constexpr uint16_t buffer_group = 0;
+
+  uring_backend() = default;
+  bool setup();
+  // the state of every fd lives behind a pointer, so growing the table never moves a buffer the kernel is using
+  socket_state &state(int);
+  socket_state *find(int);
+  io_uring_sqe *get_sqe();
+  void prepare(io_uring_sqe *, operation, int, const socket_state &);
+  void arm_accept(int);
+  void arm_wakeup(int);
+  void arm_recv(int);
+  void cancel_all(int);
+  void submit_output();
+  // submits everything prepared and, if asked to, waits for at least one completion
+  bool enter(bool);
+  void reap();
+  void handle(const io_uring_cqe &);
+  void recycle_buffer(uint16_t);
+  void queue_ready(int);
+  void queue_output(int);
+  // cancels whatever the ring has going on the socket and waits for it all to wind down
+  // a send that was cancelled puts what it didn't send back in output
+  void quiesce(int);
+  // sends as much of output as the socket takes right away, without going through the ring
+  void send_leftover_output(int);
+
+  int m_ring_fd = -1;
+  void *m_sq_ring = nullptr;
+  void *m_cq_ring = nullptr;
+  size_t m_sq_ring_size = 0;
+  size_t m_cq_ring_size = 0;
+  io_uring_sqe *m_sqes = nullptr;
+  size_t m_sqes_size = 0;
+  unsigned *m_sq_head = nullptr;
+  unsigned *m_sq_tail = nullptr;
+  unsigned *m_sq_array = nullptr;
+  unsigned m_sq_mask = 0;
+  unsigned m_sq_entries = 0;
+  unsigned m_sq_local_tail = 0;
+  unsigned *m_cq_head = nullptr;
+  unsigned *m_cq_tail = nullptr;
+  unsigned m_cq_mask = 0;
+  io_uring_cqe *m_cqes = nullptr;
+
+  io_uring_buf_ring *m_buf_ring = nullptr;
+  size_t m_buf_ring_size = 0;
+  uint8_t *m_buffers = nullptr;
+  uint16_t m_buf_tail = 0;
+
+  std::vector<std::unique_ptr<socket_state>> m_sockets;
+  std::vector<int> m_listeners;
+  // sockets with something to report on the next wait
+  std::vector<int> m_ready;
+  // sockets with output that isn't submitted yet
+  std::vector<int> m_pending_output;
+};
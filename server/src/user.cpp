@@ -4,27 +4,49 @@
 
 //
 
+#include <poll.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/eventfd.h>
+
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
-#include <tuple>
 
-std::mutex user::db_mutex;
+std::shared_mutex user::db_mutex;
 std::unordered_map<int, user> user::active_users;
+std::mutex user::file_mutex;
+std::mutex user::unsaved_mutex;
+std::unordered_map<std::string, rating> user::unsaved_ratings;
+int user::writer_fd = -1;
+std::atomic<bool> user::writer_stopping = false;
+std::thread user::writer_thread;
 
-user::user(std::string_view username, size_t rank) : m_username(username), m_rank(rank) {}
+user::user(std::string_view username, const rating &r) : m_username(username) {
+  set_rating(r);
+}
 std::string_view user::username() const {
   return m_username;
 }
 size_t user::rank() const {
   return m_rank;
 }
+rating user::current_rating() const {
+  return { static_cast<double>(m_rank), m_deviation, m_volatility };
+}
 void user::set_username(std::string_view new_username) {
   m_username = new_username;
 }
 void user::set_rank(size_t new_rank) {
   m_rank = new_rank;
 }
+void user::set_rating(const rating &r) {
+  m_rank = static_cast<size_t>(std::llround(r.value));
+  m_deviation = r.deviation;
+  m_volatility = r.volatility;
+}
 size_t user::add_to_rank(size_t to_add) {
   if (m_rank > m_rank + to_add) {
     to_add = __SIZE_MAX__ - m_rank;
@@ -46,21 +68,20 @@ size_t user::remove_from_rank(size_t to_remove) {
 
 bool user::createAccount(int fd, std::string_view username, std::string_view password) {
   const std::lock_guard lock(db_mutex);
+  const std::lock_guard file_lock(file_mutex);
 
   std::fstream usersFile;
 
   //first check if the username is taken
   {
     usersFile.open("users.txt");
-    std::string user;
-    std::string pass;
-    size_t rank;
+    account existing;
     if (usersFile.is_open() == false) {
       std::cerr << "unable to open file" << std::endl;
       return false;
     }
-    while (usersFile >> user >> pass >> rank) {
-      if (username == user) {
+    while (read_account(usersFile, existing)) {
+      if (username == existing.username) {
         std::cerr << "username is taken" << std::endl;
         return false;
       }
@@ -74,34 +95,38 @@ bool user::createAccount(int fd, std::string_view username, std::string_view pas
     std::cerr << "unable to open file" << std::endl;
     return false;
   }
-  usersFile << username << ' ' << password << ' ' << 1000 << std::endl;
+  write_account(usersFile, { std::string(username), std::string(password), rating() });
   usersFile.close();
 
   //add to the active users
-  active_users.emplace(fd, user(username, 1000));
+  active_users.emplace(fd, user(username, rating()));
   return true;
 }
 bool user::deleteAccount(int fd) {
   const std::lock_guard lock(db_mutex);
-  std::vector<std::tuple<std::string, std::string, size_t>> users;
+  const std::lock_guard file_lock(file_mutex);
+  std::vector<account> users;
   //copy everything except the user to be removed
   {
     std::ifstream usersFile("users.txt");
-    std::string user;
-    std::string pass;
-    size_t rank;
+    account existing;
     if (usersFile.is_open() == false) {
       std::cerr << "Unable to open file!" << std::endl;
       return false;
     }
-    while (usersFile >> user >> pass >> rank) {
-      if (active_users.at(fd).m_username != user) {
-        users.emplace_back(std::forward_as_tuple(user, pass, rank));
+    while (read_account(usersFile, existing)) {
+      if (active_users.at(fd).m_username != existing.username) {
+        users.push_back(existing);
       }
     }
     usersFile.close();
   }
 
+  //a rating the writer didn't get to would otherwise go to an account made with the same name later
+  {
+    const std::lock_guard unsaved_lock(unsaved_mutex);
+    unsaved_ratings.erase(active_users.at(fd).m_username);
+  }
   //remove from the active users
   active_users.erase(fd);
 
@@ -111,65 +136,218 @@ bool user::deleteAccount(int fd) {
     std::cerr << "Unable to open file!" << std::endl;
     return false;
   }
-  for (const auto& [user, pass, rank] : users) {
-    usersFile << user << " " << pass << ' ' << rank << std::endl;
+  for (const account &remaining : users) {
+    write_account(usersFile, remaining);
   }
   usersFile.close();
   return true;
 }
 bool user::getAcount(int fd, std::string_view username, std::string_view password) {
-  const std::lock_guard lock(db_mutex);
+  rating found_rating;
+  {
+    const std::shared_lock lock(db_mutex);
 
-  //checks the active users to see if the user is already logged in
-  for (auto &&[_, user] : active_users) {
-    if (user.username() == username) {
-      std::cerr << "user is already logged in" << std::endl;
+    //checks the active users to see if the user is already logged in
+    for (auto &&[_, user] : active_users) {
+      if (user.username() == username) {
+        std::cerr << "user is already logged in" << std::endl;
+        return false;
+      }
+    }
+
+    std::ifstream usersFile;
+    usersFile.open("users.txt");
+    account existing;
+    if (usersFile.is_open() == false) {
+      std::cerr << "unable to open file" << std::endl;
+      return false;
+    }
+    bool found = false;
+    while (found == false && read_account(usersFile, existing)) {
+      if (username == existing.username) {
+        if (password != existing.password) {
+          std::cerr << "incorrect password" << std::endl;
+          return false;
+        }
+        found = true;
+        found_rating = existing.account_rating;
+      }
+    }
+    usersFile.close();
+    if (found == false) {
+      std::cerr << "username not found" << std::endl;
       return false;
     }
+    //a game that ended since the last rewrite has the newer rating
+    const std::lock_guard unsaved_lock(unsaved_mutex);
+    auto unsaved = unsaved_ratings.find(existing.username);
+    if (unsaved != unsaved_ratings.end()) { found_rating = unsaved->second; }
   }
 
-  std::ifstream usersFile;
-  usersFile.open("users.txt");
-  std::string usr;
-  std::string pass;
-  size_t rank;
-  if (usersFile.is_open() == false) {
-    std::cerr << "unable to open file" << std::endl;
-    return false;
-  }
-  while (usersFile >> usr >> pass >> rank) {
-    if (username == usr) { 
-      if (password == pass) {
-        //add to the active users
-        active_users.emplace(fd, user(username, rank));
-        return true;
-      } else {
-        std::cerr << "incorrect password" << std::endl;
-        return false;
-      }
+  //the lock was let go, so another reactor could have logged the same user in since
+  const std::lock_guard lock(db_mutex);
+  for (auto &&[_, user] : active_users) {
+    if (user.username() == username) {
+      std::cerr << "user is already logged in" << std::endl;
+      return false;
     }
   }
-  usersFile.close();
-  std::cerr << "username not found" << std::endl;
-  return false;
+  //add to the active users
+  active_users.emplace(fd, user(username, found_rating));
+  return true;
 }
 void user::disconnectUser(int fd) {
   const std::lock_guard lock(db_mutex);
   active_users.erase(fd);
 }
 bool user::isActiveUser(int fd) {
+  const std::shared_lock lock(db_mutex);
   return active_users.contains(fd);
 }
 size_t user::get_rank_by_fd(int fd) {
+  const std::shared_lock lock(db_mutex);
   return active_users.at(fd).m_rank;
 }
 std::string_view user::get_username_by_fd(int fd) {
+  const std::shared_lock lock(db_mutex);
   return active_users.at(fd).m_username;
 }
-void user::recv_send_fail_handler(int fd, std::string_view message, int err) {
-  error_print(message, err);
-  disconnectUser(fd);
-  if (err != EBADFD) {
-    if (close(fd) == -1) { error_print("close"); }
+rating user::get_rating_by_fd(int fd) {
+  const std::shared_lock lock(db_mutex);
+  return active_users.at(fd).current_rating();
+}
+void user::set_rating_by_fd(int fd, const rating &r) {
+  const std::lock_guard lock(db_mutex);
+  active_users.at(fd).set_rating(r);
+}
+
+bool user::read_account(std::istream &in, account &a) {
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    size_t rank;
+    if (!(fields >> a.username >> a.password >> rank)) { continue; }
+    a.account_rating = rating();
+    a.account_rating.value = static_cast<double>(rank);
+    double deviation, volatility;
+    if (fields >> deviation >> volatility) {
+      a.account_rating.deviation = deviation;
+      a.account_rating.volatility = volatility;
+    }
+    return true;
+  }
+  return false;
+}
+void user::write_account(std::ostream &out, const account &a) {
+  out << a.username << ' ' << a.password << ' ' << std::llround(a.account_rating.value) << ' ';
+  out << a.account_rating.deviation << ' ' << a.account_rating.volatility << '\n';
+}
+
+void user::start_writer() {
+  writer_fd = eventfd(0, EFD_CLOEXEC);
+  if (writer_fd == -1) { error_print("user writer eventfd"); }
+  writer_thread = std::thread(write_ratings);
+}
+void user::save_rating(std::string_view username, const rating &r) {
+  bool first;
+  {
+    const std::lock_guard unsaved_lock(unsaved_mutex);
+    first = unsaved_ratings.empty();
+    unsaved_ratings.insert_or_assign(std::string(username), r);
+  }
+  //the writer is already waiting out the flush interval for the others
+  if (first) { wake_writer(); }
+}
+void user::stop_writer() {
+  writer_stopping.store(true);
+  wake_writer();
+  writer_thread.join();
+  if (close(writer_fd) == -1) { error_print("user writer close eventfd"); }
+}
+void user::write_ratings() {
+  while (true) {
+    pollfd pfd = { writer_fd, POLLIN, 0 };
+    if (poll(&pfd, 1, -1) == -1) {
+      if (errno != EINTR) { error_print("user writer poll"); }
+      continue;
+    }
+    uint64_t count;
+    if (read(writer_fd, &count, sizeof(count)) == -1) { error_print("user writer eventfd read"); }
+    //the ratings of the games that end in the meantime go out with this one, only stopping cuts it short
+    if (writer_stopping.load() == false && poll(&pfd, 1, static_cast<int>(flush_interval.count())) == -1 && errno != EINTR) {
+      error_print("user writer poll");
+    }
+    flush_ratings();
+    if (writer_stopping.load()) { break; }
+  }
+}
+void user::wake_writer() {
+  uint64_t one = 1;
+  if (write(writer_fd, &one, sizeof(one)) == -1) { error_print("user writer eventfd write"); }
+}
+void user::flush_ratings() {
+  std::unordered_map<std::string, rating> to_write;
+  {
+    //account creation and deletion wait for the rewrite instead of getting lost in it
+    const std::lock_guard file_lock(file_mutex);
+    {
+      const std::lock_guard unsaved_lock(unsaved_mutex);
+      to_write = unsaved_ratings;
+    }
+    if (to_write.empty()) { return; }
+    if (rewrite_users_file(to_write) == false) {
+      //they're still unsaved, the next rewrite tries again
+      wake_writer();
+      return;
+    }
+  }
+  //a login that read the old file is done looking at the unsaved ratings once the writer gets db_mutex
+  const std::lock_guard lock(db_mutex);
+  const std::lock_guard unsaved_lock(unsaved_mutex);
+  for (auto &&[username, r] : to_write) {
+    auto unsaved = unsaved_ratings.find(username);
+    //a newer rating that came in during the rewrite waits for the next one
+    if (unsaved != unsaved_ratings.end() && unsaved->second == r) { unsaved_ratings.erase(unsaved); }
   }
+  //save_rating only wakes the writer for the first unsaved rating, and those came in while there were others
+  if (unsaved_ratings.empty() == false) { wake_writer(); }
+  fprintf(stderr, "saved %zu ratings\n", to_write.size());
+}
+bool user::rewrite_users_file(const std::unordered_map<std::string, rating> &to_write) {
+  std::vector<account> accounts;
+  {
+    std::ifstream usersFile("users.txt");
+    if (usersFile.is_open() == false) {
+      std::cerr << "unable to open file" << std::endl;
+      return false;
+    }
+    account existing;
+    while (read_account(usersFile, existing)) {
+      auto changed = to_write.find(existing.username);
+      if (changed != to_write.end()) { existing.account_rating = changed->second; }
+      accounts.push_back(existing);
+    }
+  }
+  //written next to it and renamed over it, so a crash halfway leaves the old file instead of half of it
+  //logins read it meanwhile, they either get the old file or the new one
+  {
+    std::ofstream usersFile("users.txt.tmp", std::ios_base::trunc);
+    if (usersFile.is_open() == false) {
+      std::cerr << "unable to open file" << std::endl;
+      return false;
+    }
+    for (const account &a : accounts) {
+      write_account(usersFile, a);
+    }
+    usersFile.flush();
+    if (usersFile.fail()) {
+      std::cerr << "unable to write users.txt.tmp" << std::endl;
+      return false;
+    }
+  }
+  if (rename("users.txt.tmp", "users.txt") == -1) {
+    error_print("user writer rename");
+    return false;
+  }
+  return true;
 }
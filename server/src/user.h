@@ -1,22 +1,32 @@
 #pragma once
 
 #include "../../common/enums.h"
+#include "rating.h"
 
 #include "sys/socket.h"
 
+#include <atomic>
+#include <chrono>
+#include <istream>
 #include <optional>
+#include <ostream>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
+#include <thread>
 #include <unordered_map>
 
 class user {
 public:
-  user(std::string_view, size_t);
+  user(std::string_view, const rating &);
 
   std::string_view username() const;
   size_t rank() const;
+  // the rank is the rating's value, rounded
+  rating current_rating() const;
   void set_username(std::string_view);
   void set_rank(size_t);
+  void set_rating(const rating &);
   size_t add_to_rank(size_t);
   size_t remove_from_rank(size_t);
 
@@ -32,11 +42,55 @@ public:
   static bool isActiveUser(int);
   static size_t get_rank_by_fd(int);
   static std::string_view get_username_by_fd(int);
-  static void recv_send_fail_handler(int, std::string_view, int = errno);
+  static rating get_rating_by_fd(int);
+  static void set_rating_by_fd(int, const rating &);
+
+  // ratings that changed are written to users.txt by a background writer, a rewrite at most once every flush_interval
+  // whatever changes in the meantime goes out with the same rewrite, so the games that end in a burst cost a single one
+  static void start_writer();
+  // keeps the username's new rating until the writer gets to it, logins see it before then too
+  // never waits for the disk, it can be called from any thread
+  static void save_rating(std::string_view, const rating &);
+  // writes whatever is left and stops the writer
+  static void stop_writer();
 
 private:
-  static std::mutex db_mutex;
+  // one line of users.txt: username, password, rank, deviation and volatility
+  struct account {
+    std::string username;
+    std::string password;
+    rating account_rating;
+  };
+
+  static constexpr std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000);
+
+  // returns false once there are no more accounts
+  // lines from before ratings had a deviation only have a rank, they get the initial deviation and volatility
+  static bool read_account(std::istream &, account &);
+  static void write_account(std::ostream &, const account &);
+  static void write_ratings();
+  static void wake_writer();
+  // rewrites users.txt with the unsaved ratings and takes the ones it saved out of them
+  // db_mutex is only held to take them out, the reactors never wait for the disk
+  static void flush_ratings();
+  // returns false if users.txt couldn't be read or replaced, has to be called with file_mutex held
+  static bool rewrite_users_file(const std::unordered_map<std::string, rating> &);
+
+  // shared while users.txt or active_users are only read, so the reactors can look up logins in parallel
+  static std::shared_mutex db_mutex;
   static std::unordered_map<int, user> active_users;
+  // held by everything that writes users.txt, account creation and deletion take it after db_mutex
+  static std::mutex file_mutex;
+  // only held to add to or take the unsaved ratings, never around the disk
+  // a rating stays here until users.txt has it and is only taken out with db_mutex held, so a login either finds it here or in users.txt
+  static std::mutex unsaved_mutex;
+  static std::unordered_map<std::string, rating> unsaved_ratings;
+  // written when the first unsaved rating comes in after a rewrite, or to stop the writer
+  static int writer_fd;
+  static std::atomic<bool> writer_stopping;
+  static std::thread writer_thread;
   std::string m_username;
   size_t m_rank;
+  double m_deviation;
+  double m_volatility;
 };
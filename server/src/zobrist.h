@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <array>
+
+// one random key for every feature of a position, a position's key is all of its features' keys xor-ed together
+struct zobrist_keys {
+  // indexed by board::piece_index, then by square
+  std::array<std::array<uint64_t, 64>, 12> pieces;
+  uint64_t black_to_move;
+  // indexed like board::m_can_castle
+  std::array<std::array<uint64_t, 2>, 2> can_castle;
+  // indexed by the en passant collumn
+  std::array<uint64_t, 8> en_passant;
+};
+
+// splitmix64 with a fixed seed, so the keys are the same on every build and every run
+constexpr zobrist_keys make_zobrist_keys() {
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  auto next = [&state]() {
+    state += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  };
+  zobrist_keys keys {};
+  for (std::array<uint64_t, 64> &piece : keys.pieces) {
+    for (uint64_t &key : piece) { key = next(); }
+  }
+  keys.black_to_move = next();
+  for (std::array<uint64_t, 2> &sides : keys.can_castle) {
+    for (uint64_t &key : sides) { key = next(); }
+  }
+  for (uint64_t &key : keys.en_passant) { key = next(); }
+  return keys;
+}
+
+inline constexpr zobrist_keys zobrist = make_zobrist_keys();
@@ -0,0 +1,102 @@
+#include "../src/board.h"
+#include "../src/bitboard.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <array>
+#include <new>
+#include <random>
+#include <string_view>
+#include <vector>
+
+// checks that generating moves and validating them never touches the heap, and that games at rest keep their histories compact
+// the global operator new is replaced with one that counts, everything the checks do between two reads of the count has to leave it alone
+// usage: alloc_test [games]
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  allocations += 1;
+  void *retval = malloc(size == 0 ? 1 : size);
+  if (retval == nullptr) { throw std::bad_alloc(); }
+  return retval;
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+  allocations += 1;
+  void *retval = aligned_alloc(static_cast<size_t>(alignment), (size + static_cast<size_t>(alignment) - 1) / static_cast<size_t>(alignment) * static_cast<size_t>(alignment));
+  if (retval == nullptr) { throw std::bad_alloc(); }
+  return retval;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept { free(p); }
+
+static const std::array<std::string_view, 5> positions = {
+  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+  "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+  "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+  "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+};
+
+int main(int argc, char **argv) {
+  const unsigned games = argc > 1 ? static_cast<unsigned>(atoi(argv[1])) : 200;
+  attacks::init();
+  bool all_correct = true;
+
+  for (std::string_view fen : positions) {
+    board b;
+    if (!b.load_fen(fen)) {
+      fprintf(stdout, "could not load %s\n", fen.data());
+      all_correct = false;
+      continue;
+    }
+    move_list moves;
+    const size_t before = allocations;
+    b.generate_legal_moves(moves);
+    if (allocations != before) {
+      fprintf(stdout, "generate_legal_moves allocated %zu times for %s\n", allocations - before, fen.data());
+      all_correct = false;
+    }
+  }
+
+  //random games played the way game::check_move plays them: expand the packed board, check the move, pack it back
+  //packing is where a game's history grows or gets given back, so only the expanded board is counted
+  //the board packed first hands its reserved history over to the boards expanded after it
+  std::mt19937 gen(2048);
+  size_t plies = 0;
+  for (unsigned i = 0; i < games; i += 1) {
+    std::vector<uint64_t> history;
+    packed_board packed = board().pack(history);
+    size_t expanded_allocations = 0;
+    message result = message::confirmation;
+    while (result == message::confirmation) {
+      const size_t before = allocations;
+      board expanded(packed, history);
+      move_list moves;
+      expanded.generate_legal_moves(moves);
+      const packed_move m = *(moves.begin() + std::uniform_int_distribution<size_t>(0, moves.size() - 1)(gen));
+      result = expanded.check_move(to_coords(m.from()), to_coords(m.to()), m.promotes_to());
+      expanded_allocations += allocations - before;
+      packed = expanded.pack(history);
+      plies += 1;
+      if (result == message::rejection) {
+        fprintf(stdout, "game %u: a generated move was rejected\n", i);
+        all_correct = false;
+      }
+      //a packed history never holds a whole chunk more than it needs
+      if (history.capacity() >= history.size() + 8) {
+        fprintf(stdout, "game %u: %zu keys kept in room for %zu\n", i, history.size(), history.capacity());
+        all_correct = false;
+      }
+    }
+    if (expanded_allocations != 0) {
+      fprintf(stdout, "game %u: validating moves allocated %zu times\n", i, expanded_allocations);
+      all_correct = false;
+    }
+  }
+  fprintf(stdout, "%zu positions and %u games (%zu plies) checked, %s\n", positions.size(), games, plies, all_correct ? "no allocations" : "FAILED");
+  return all_correct ? EXIT_SUCCESS : EXIT_FAILURE;
+}